@@ -38,7 +38,9 @@ void _EEPROM_readData(int &pos, uint8_t* value, uint8_t size)
 // the default values are used whenever there is a change to the data, to prevent
 // wrong data being written to the variables.
 // ALSO:  always make sure the variables in the Store and retrieve sections are in the same order.
-#define EEPROM_VERSION "V12"
+#define EEPROM_VERSION "V13"
+// V13 added the Kc and bed PID settings at the end, V12 settings are still read and these get their defaults.
+#define EEPROM_VERSION_V12 "V12"
 
 #ifdef EEPROM_SETTINGS
 void Config_StoreSettings()
@@ -90,6 +92,22 @@ void Config_StoreSettings()
   #endif
   EEPROM_WRITE_VAR(i,retract_length);
   EEPROM_WRITE_VAR(i,retract_feedrate);
+  #if defined(PIDTEMP) && defined(PID_ADD_EXTRUSION_RATE)
+    EEPROM_WRITE_VAR(i,Kc);
+  #else
+    float dummyKc = 0.0f;
+    EEPROM_WRITE_VAR(i,dummyKc);
+  #endif
+  #ifdef PIDTEMPBED
+    EEPROM_WRITE_VAR(i,bedKp);
+    EEPROM_WRITE_VAR(i,bedKi);
+    EEPROM_WRITE_VAR(i,bedKd);
+  #else
+    float dummyBed = 0.0f;
+    EEPROM_WRITE_VAR(i,dummyBed);
+    EEPROM_WRITE_VAR(i,dummyBed);
+    EEPROM_WRITE_VAR(i,dummyBed);
+  #endif
   char ver2[4]=EEPROM_VERSION;
   i=EEPROM_OFFSET;
   EEPROM_WRITE_VAR(i,ver2); // validate data
@@ -160,6 +178,16 @@ void Config_PrintSettings()
     SERIAL_ECHOPAIR("   M301 P",Kp);
     SERIAL_ECHOPAIR(" I" ,unscalePID_i(Ki));
     SERIAL_ECHOPAIR(" D" ,unscalePID_d(Kd));
+#ifdef PID_ADD_EXTRUSION_RATE
+    SERIAL_ECHOPAIR(" C" ,Kc);
+#endif
+    SERIAL_ECHOLN("");
+#endif
+#ifdef PIDTEMPBED
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPAIR("   M304 P",bedKp);
+    SERIAL_ECHOPAIR(" I" ,unscalePID_i(bedKi));
+    SERIAL_ECHOPAIR(" D" ,unscalePID_d(bedKd));
     SERIAL_ECHOLN("");
 #endif
 }
@@ -174,7 +202,7 @@ void Config_RetrieveSettings()
     char ver[4]=EEPROM_VERSION;
     EEPROM_READ_VAR(i,stored_ver); //read stored version
     //  SERIAL_ECHOLN("Version: [" << ver << "] Stored version: [" << stored_ver << "]");
-    if (strncmp(ver,stored_ver,3) == 0)
+    if (strncmp(ver,stored_ver,3) == 0 || strncmp_P(stored_ver, PSTR(EEPROM_VERSION_V12), 3) == 0)
     {
         // version number match
         EEPROM_READ_VAR(i,axis_steps_per_unit);
@@ -221,6 +249,32 @@ void Config_RetrieveSettings()
         #endif
         EEPROM_READ_VAR(i,retract_length);
         EEPROM_READ_VAR(i,retract_feedrate);
+        #if defined(PIDTEMP) && defined(PID_ADD_EXTRUSION_RATE)
+        Kc = DEFAULT_Kc;
+        #endif
+        #ifdef PIDTEMPBED
+        bedKp = DEFAULT_bedKp;
+        bedKi = scalePID_i(DEFAULT_bedKi);
+        bedKd = scalePID_d(DEFAULT_bedKd);
+        #endif
+        if (strncmp(ver,stored_ver,3) == 0)
+        {
+            float dummy;
+            #if defined(PIDTEMP) && defined(PID_ADD_EXTRUSION_RATE)
+            EEPROM_READ_VAR(i,Kc);
+            #else
+            EEPROM_READ_VAR(i,dummy);
+            #endif
+            #ifdef PIDTEMPBED
+            EEPROM_READ_VAR(i,bedKp);
+            EEPROM_READ_VAR(i,bedKi);
+            EEPROM_READ_VAR(i,bedKd);
+            #else
+            EEPROM_READ_VAR(i,dummy);
+            EEPROM_READ_VAR(i,dummy);
+            EEPROM_READ_VAR(i,dummy);
+            #endif
+        }
 
 		// Call updatePID (similar to when we have processed M301)
 		updatePID();
@@ -284,6 +338,12 @@ void Config_ResetDefault()
     Kc = DEFAULT_Kc;
 #endif//PID_ADD_EXTRUSION_RATE
 #endif//PIDTEMP
+#ifdef PIDTEMPBED
+    bedKp = DEFAULT_bedKp;
+    bedKi = scalePID_i(DEFAULT_bedKi);
+    bedKd = scalePID_d(DEFAULT_bedKd);
+    updatePID();
+#endif//PIDTEMPBED
     float tmp_motor_current_setting[]=DEFAULT_PWM_MOTOR_CURRENT;
     motor_current_setting[0] = tmp_motor_current_setting[0];
     motor_current_setting[1] = tmp_motor_current_setting[1];
@@ -24,12 +24,33 @@
 // if CooldownNoWait is defined M109 will not wait for the cooldown to finish
 #define CooldownNoWait true
 
+// M109 and M190 set the target and return, the first move that extrudes waits for the temperatures instead.
+// Homing and travel moves run while heating up, and the bed and the nozzles heat up at the same time. An M109 that cools down still waits.
+#define HEAT_WAIT_DEFERRED
+
+// Log the temperatures and the average heater powers every TEMP_LOG_INTERVAL seconds, the last TEMP_LOG_SAMPLES samples are kept (5 minutes).
+// M156 sends the log, the LCD shows it as a graph. Each sample takes 3 + 3 * EXTRUDERS bytes of RAM, about 380 bytes in all with 60 samples.
+// M155 S<seconds> sends the temperatures every interval, so a host does not have to poll with M105.
+// A diagnostic, off by default to keep the RAM for the stack.
+//#define TEMP_LOG
+#define TEMP_LOG_INTERVAL 5
+#define TEMP_LOG_SAMPLES 60
+
+// Drive the hotend heaters with a sigma-delta modulator instead of the 7 bit soft PWM. The power has 12 bits (the PID output
+// with 4 fraction bits) and every Timer0 tick (1ms) decides on/off, so a new power takes effect right away.
+// The hotend heater pins switch up to 500 times per second, only enable this when their FETs are checked for it.
+// The bed keeps the 7 bit soft PWM, SOFT_PWM_SCALE then only applies to the bed and FAN_SOFT_PWM.
+//#define HEATER_SIGMA_DELTA
+
 #ifdef PIDTEMP
   // this adds an experimental additional term to the heatingpower, proportional to the extrusion speed.
   // if Kc is choosen well, the additional required power due to increased melting should be compensated.
+  // The extrusion speed is taken from the queued moves, PID_EXTRUSION_RATE_LOOKAHEAD ahead, so the heater starts before the flow changes.
+  // M303 F<mm/sec> measures Kc during the autotune by extruding at that speed.
   #define PID_ADD_EXTRUSION_RATE
   #ifdef PID_ADD_EXTRUSION_RATE
-    #define  DEFAULT_Kc (1) //heatingpower=Kc*(e_speed)
+    #define  DEFAULT_Kc (25) //heatingpower=Kc*(e_speed), PWM (0-255) per mm/sec of filament
+    #define PID_EXTRUSION_RATE_LOOKAHEAD 3000 // ms, about the time the heater needs to warm the nozzle
   #endif
 #endif
 
@@ -213,6 +234,48 @@
 #define SD_FINISHED_STEPPERRELEASE true  //if sd support and the file is finished: disable steppers?
 #define SD_FINISHED_RELEASECOMMAND "M84 X Y Z E" // You might want to keep the z enabled so your bed stays in place.
 
+// Read the next block of the SD print into a second 512 byte buffer during the idle time of the main loop, so a slow card read
+// at a block boundary does not stall the command queue. Costs 517 bytes of RAM, the sequential reads use CMD18 without it as well.
+//#define SD_BLOCK_PREFETCH
+
+// Directory positions remembered for the file browser. While the files of the current folder are counted, the position of every
+// Nth file is stored, with N doubling when the index fills up. Getting a file name then reads at most N entries instead of the whole
+// folder up to that file. Costs 2 bytes of RAM per position, set to 0 to disable.
+#define SD_DIR_INDEX_SIZE 64
+
+// Keep the G-code header information shown by the file browser (print time, material, nozzle size) in a hidden index file on the card,
+// so browsing does not have to open every file. Files of the current folder are added in the background while the printer is idle.
+// The index is SD_GCODE_META_INDEX_SLOTS records long, files are placed by a hash of their folder and directory entry.
+// Costs about 40 bytes of RAM (a second file handle), the index itself is on the card.
+#define SD_GCODE_META_INDEX
+#define SD_GCODE_META_INDEX_SLOTS 512
+
+// Show the files of a folder sorted by name or by date (newest first), in the file browser and in M20. Set the order with M34 S<0|1|2>, 0 is directory order,
+// it is stored in the EEPROM. The order is kept in a hidden file on the card, it is made in passes over the folder that each sort SD_SORT_PASS_SIZE files,
+// so the RAM used does not depend on the number of files. Names are compared on their first 11 characters.
+// The file is used again as long as the files of the folder, their names and dates, are the same. M20 does not make a new order while printing.
+// Costs about 36 bytes of RAM (a file handle), building the order uses SD_SORT_PASS_SIZE entries on the stack.
+#define SD_SORT
+#define SD_SORT_PASS_SIZE 16
+#define SD_SORT_DEFAULT_MODE SD_SORT_NONE
+
+// Read the SD print up to SD_PREHEAT_LOOKAHEAD bytes ahead of the command queue and look for M104/M109 hotend temperature changes.
+// A change is started early, by the time it takes to heat or cool at SD_PREHEAT_RATE C/s at the measured file read rate,
+// so tool changes and temperature towers do not wait for the nozzle. Temperatures of 0 (heater off) are not started early.
+// Costs about 100 bytes of RAM (a file handle, the scanned line and 4 queued changes) and 32 bytes of stack while scanning.
+#define SD_PREHEAT_LOOKAHEAD 32768
+#define SD_PREHEAT_RATE 2
+
+// Store the SD file position of the oldest unfinished command with the position, temperatures and fan speed every
+// POWER_LOSS_CHECKPOINT_INTERVAL seconds while printing from SD, so a print that was cut off by a power failure can be resumed with M1000.
+// Checkpoints are written one byte per loop to a ring of EEPROM slots, with 16 slots and 60 seconds each slot lasts for about 3 years of printing.
+// Costs about 70 bytes of RAM, and 7 bytes per planner block (110 bytes with 16 blocks).
+#define POWER_LOSS_RESUME
+#define POWER_LOSS_CHECKPOINT_INTERVAL 60
+#define POWER_LOSS_CHECKPOINT_SLOTS 16
+// The bed is lowered by POWER_LOSS_RESUME_Z_LIFT mm while X and Y are homed and the head travels back over the print.
+#define POWER_LOSS_RESUME_Z_LIFT 5
+
 // The hardware watchdog should reset the Microcontroller disabling all outputs, in case the firmware gets stuck and doesn't do temperature regulation.
 #define USE_WATCHDOG
 
@@ -246,9 +309,25 @@
 #endif // ADVANCE
 
 // Arc interpretation settings:
-#define MM_PER_ARC_SEGMENT 1
+// The segment length is chosen so the chords stay within ARC_CHORD_TOLERANCE (mm) of the real arc,
+// limited to MIN/MAX_MM_PER_ARC_SEGMENT. Segments are never made shorter than the distance traveled
+// in the minimum segment time at the requested feedrate, as the planner would slow those down.
+#define ARC_CHORD_TOLERANCE 0.01
+#define MIN_MM_PER_ARC_SEGMENT 0.1
+#define MAX_MM_PER_ARC_SEGMENT 5
 #define N_ARC_CORRECTION 25
 
+// Collinear segment coalescing: consecutive G0/G1 moves that continue in the same direction, with the same feedrate
+// and the same amount of extrusion per mm, are merged into a single planner block. This saves planner time and
+// block slots on the runs of tiny segments slicers produce, and gives the look ahead a longer distance to plan over.
+#define SEGMENT_COALESCING
+#ifdef SEGMENT_COALESCING
+  #define COALESCE_MIN_COS 0.9999            // Cosine of the maximum angle between merged segments (about 0.8 degree)
+  #define COALESCE_MAX_DEVIATION 0.01        // Maximum distance in mm between a merged corner and the resulting line
+  #define COALESCE_MAX_LENGTH 10             // Maximum length in mm of a merged move
+  #define COALESCE_E_RATIO_TOLERANCE 0.01    // Maximum relative difference in extrusion per mm between merged segments
+#endif
+
 const unsigned int dropsegments=5; //everything with less than this number of steps will be ignored as move and joined with the next movement
 
 // If you are using a RAMPS board or cheap E-bay purchased boards that do not detect when an SD card is inserted
@@ -294,6 +373,15 @@ const unsigned int dropsegments=5; //everything with less than this number of st
 #define MAX_CMD_SIZE 96
 #define BUFSIZE 8
 
+//The buffer for recieving from the serial. Filled from the RX interrupt only, so it needs to hold all characters that can arrive
+//while the main loop is busy (at 250000 baud that is 25 characters per ms). Every byte costs a byte of RAM.
+//The RX_BUFFER_SIZE needs to be a power of 2, 256 at most.
+#define RX_BUFFER_SIZE 256
+
+//The buffer for sending to the serial. Output is send from the UDRE interrupt, so printing only blocks when this buffer is full.
+//The TX_BUFFER_SIZE needs to be a power of 2.
+#define TX_BUFFER_SIZE 64
+
 
 // Firmware based and LCD controled retract
 // M207 and M208 can be used to define parameters for the retraction.
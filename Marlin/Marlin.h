@@ -194,6 +194,7 @@ void setPwmFrequency(uint8_t pin, int val);
 #endif //CRITICAL_SECTION_START
 
 extern float homing_feedrate[];
+extern float feedrate;
 extern bool axis_relative_modes[];
 extern int feedmultiply;
 extern int extrudemultiply[EXTRUDERS]; // Sets extrude multiply factor (in percent)
@@ -29,20 +29,24 @@
 #if defined(UBRRH) || defined(UBRR0H) || defined(UBRR1H) || defined(UBRR2H) || defined(UBRR3H)
 
 #if UART_PRESENT(SERIAL_PORT)
-  ring_buffer rx_buffer  =  { { 0 }, 0, 0 };
+  ring_buffer rx_buffer  =  { { 0 }, 0, 0, 0, 0 };
+  tx_ring_buffer tx_buffer  =  { { 0 }, 0, 0 };
 #endif
 
 FORCE_INLINE void store_char(unsigned char c)
 {
-  int i = (unsigned int)(rx_buffer.head + 1) % RX_BUFFER_SIZE;
+  uint8_t h = rx_buffer.head;
+  uint8_t i = (h + 1) & (RX_BUFFER_SIZE - 1);
 
   // if we should be storing the received character into the location
   // just before the tail (meaning that the head would advance to the
   // current location of the tail), we're about to overflow the buffer
   // and so we don't write the character or advance the head.
   if (i != rx_buffer.tail) {
-    rx_buffer.buffer[rx_buffer.head] = c;
+    rx_buffer.buffer[h] = c;
     rx_buffer.head = i;
+  } else if (rx_buffer.buffer_overruns < 0xFFFF) {
+    rx_buffer.buffer_overruns++;
   }
 }
 
@@ -53,11 +57,34 @@ FORCE_INLINE void store_char(unsigned char c)
   //SIGNAL(SIG_USART_RECV)
   SIGNAL(M_USARTx_RX_vect)
   {
+    // The data overrun flag is only valid till UDR is read.
+    if ((M_UCSRxA & (1 << M_DORx)) && rx_buffer.hardware_overruns < 0xFFFF)
+      rx_buffer.hardware_overruns++;
     unsigned char c  =  M_UDRx;
     store_char(c);
   }
 #endif
 
+// Send the next character from the TX buffer, disable the interrupt again when the buffer is empty.
+FORCE_INLINE void tx_udr_empty_irq(void)
+{
+  uint8_t t = tx_buffer.tail;
+  if (t != tx_buffer.head)
+  {
+    M_UDRx = tx_buffer.buffer[t];
+    tx_buffer.tail = (t + 1) & (TX_BUFFER_SIZE - 1);
+  }
+  if (tx_buffer.tail == tx_buffer.head)
+    cbi(M_UCSRxB, M_UDRIEx);
+}
+
+#if defined(M_USARTx_UDRE_vect)
+  ISR(M_USARTx_UDRE_vect)
+  {
+    tx_udr_empty_irq();
+  }
+#endif
+
 // Constructors ////////////////////////////////////////////////////////////////
 
 MarlinSerial::MarlinSerial()
@@ -103,6 +130,43 @@ void MarlinSerial::end()
   cbi(M_UCSRxB, M_RXENx);
   cbi(M_UCSRxB, M_TXENx);
   cbi(M_UCSRxB, M_RXCIEx);
+  cbi(M_UCSRxB, M_UDRIEx);
+}
+
+void MarlinSerial::write(uint8_t c)
+{
+  // If the buffer and the data register are empty, just put the byte in the data register and be done.
+  // This shortcut keeps the latency of single characters as low as it used to be.
+  if (tx_buffer.head == tx_buffer.tail && (M_UCSRxA & (1 << M_UDREx)))
+  {
+    M_UDRx = c;
+    return;
+  }
+
+  if (!(SREG & _BV(SREG_I)))
+  {
+    // Interrupts are disabled (we are called from an ISR, or from kill()), so the UDRE interrupt will never
+    // empty the buffer. Flush it by polling, and send this character directly.
+    while (tx_buffer.head != tx_buffer.tail)
+    {
+      while (!(M_UCSRxA & (1 << M_UDREx)))
+        ;
+      tx_udr_empty_irq();
+    }
+    while (!(M_UCSRxA & (1 << M_UDREx)))
+      ;
+    M_UDRx = c;
+    return;
+  }
+
+  uint8_t i = (tx_buffer.head + 1) & (TX_BUFFER_SIZE - 1);
+  // If the buffer is full we have no choice but to wait till the interrupt made some room.
+  while (i == tx_buffer.tail)
+    ;
+
+  tx_buffer.buffer[tx_buffer.head] = c;
+  tx_buffer.head = i;
+  sbi(M_UCSRxB, M_UDRIEx);
 }
 
 
@@ -123,7 +187,7 @@ int MarlinSerial::read(void)
     return -1;
   } else {
     unsigned char c = rx_buffer.buffer[rx_buffer.tail];
-    rx_buffer.tail = (unsigned int)(rx_buffer.tail + 1) % RX_BUFFER_SIZE;
+    rx_buffer.tail = (rx_buffer.tail + 1) & (RX_BUFFER_SIZE - 1);
     return c;
   }
 }
@@ -142,6 +206,24 @@ void MarlinSerial::flush()
   rx_buffer.head = rx_buffer.tail;
 }
 
+uint16_t MarlinSerial::rxBufferOverruns()
+{
+  uint16_t ret;
+  CRITICAL_SECTION_START;
+  ret = rx_buffer.buffer_overruns;
+  CRITICAL_SECTION_END;
+  return ret;
+}
+
+uint16_t MarlinSerial::rxHardwareOverruns()
+{
+  uint16_t ret;
+  CRITICAL_SECTION_START;
+  ret = rx_buffer.hardware_overruns;
+  CRITICAL_SECTION_END;
+  return ret;
+}
+
 
 
 
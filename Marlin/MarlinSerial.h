@@ -49,11 +49,14 @@
 #define M_TXENx SERIAL_REGNAME(TXEN,SERIAL_PORT,)
 #define M_RXCIEx SERIAL_REGNAME(RXCIE,SERIAL_PORT,)
 #define M_UDREx SERIAL_REGNAME(UDRE,SERIAL_PORT,)
+#define M_UDRIEx SERIAL_REGNAME(UDRIE,SERIAL_PORT,)
 #define M_UDRx SERIAL_REGNAME(UDR,SERIAL_PORT,)
 #define M_UBRRxH SERIAL_REGNAME(UBRR,SERIAL_PORT,H)
 #define M_UBRRxL SERIAL_REGNAME(UBRR,SERIAL_PORT,L)
 #define M_RXCx SERIAL_REGNAME(RXC,SERIAL_PORT,)
+#define M_DORx SERIAL_REGNAME(DOR,SERIAL_PORT,)
 #define M_USARTx_RX_vect SERIAL_REGNAME(USART,SERIAL_PORT,_RX_vect)
+#define M_USARTx_UDRE_vect SERIAL_REGNAME(USART,SERIAL_PORT,_UDRE_vect)
 #define M_U2Xx SERIAL_REGNAME(U2X,SERIAL_PORT,)
 
 
@@ -70,18 +73,46 @@
 // using a ring buffer (I think), in which rx_buffer_head is the index of the
 // location to which to write the next incoming character and rx_buffer_tail
 // is the index of the location from which to read.
+// Incoming data is only stored by the RX interrupt, the buffer size is set in Configuration_adv.h.
+// Every byte costs a byte of RAM, and it needs to be a power of 2 so the index can wrap with a mask.
+#ifndef RX_BUFFER_SIZE
 #define RX_BUFFER_SIZE 128
-
+#endif
+#if RX_BUFFER_SIZE > 256 || (RX_BUFFER_SIZE & (RX_BUFFER_SIZE - 1)) != 0
+#error RX_BUFFER_SIZE needs to be a power of 2, and 256 at most
+#endif
 
 struct ring_buffer
 {
   unsigned char buffer[RX_BUFFER_SIZE];
-  int head;
-  int tail;
+  volatile uint8_t head;
+  volatile uint8_t tail;
+  // Number of received characters that got lost because the ring buffer was full.
+  volatile uint16_t buffer_overruns;
+  // Number of times the USART reported a data overrun, the RX interrupt was blocked for too long.
+  volatile uint16_t hardware_overruns;
+};
+
+// Outgoing data is put in a second ring buffer, which is emptied by the "USART data register empty"
+// interrupt. So printing only blocks when this buffer is full, instead of waiting for every single
+// character to be shifted out. The size needs to be a power of 2.
+#ifndef TX_BUFFER_SIZE
+#define TX_BUFFER_SIZE 64
+#endif
+#if TX_BUFFER_SIZE > 256 || (TX_BUFFER_SIZE & (TX_BUFFER_SIZE - 1)) != 0
+#error TX_BUFFER_SIZE needs to be a power of 2, and 256 at most
+#endif
+
+struct tx_ring_buffer
+{
+  unsigned char buffer[TX_BUFFER_SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
 };
 
 #if UART_PRESENT(SERIAL_PORT)
   extern ring_buffer rx_buffer;
+  extern tx_ring_buffer tx_buffer;
 #endif
 
 class MarlinSerial //: public Stream
@@ -97,35 +128,13 @@ class MarlinSerial //: public Stream
 
     FORCE_INLINE int available(void)
     {
-      return (unsigned int)(RX_BUFFER_SIZE + rx_buffer.head - rx_buffer.tail) % RX_BUFFER_SIZE;
+      return (unsigned int)(RX_BUFFER_SIZE + rx_buffer.head - rx_buffer.tail) & (RX_BUFFER_SIZE - 1);
     }
 
-    FORCE_INLINE void write(uint8_t c)
-    {
-      while (!((M_UCSRxA) & (1 << M_UDREx)))
-        ;
-
-      M_UDRx = c;
-    }
-
-
-    FORCE_INLINE void checkRx(void)
-    {
-      if((M_UCSRxA & (1<<M_RXCx)) != 0) {
-        unsigned char c  =  M_UDRx;
-        int i = (unsigned int)(rx_buffer.head + 1) % RX_BUFFER_SIZE;
-
-        // if we should be storing the received character into the location
-        // just before the tail (meaning that the head would advance to the
-        // current location of the tail), we're about to overflow the buffer
-        // and so we don't write the character or advance the head.
-        if (i != rx_buffer.tail) {
-          rx_buffer.buffer[rx_buffer.head] = c;
-          rx_buffer.head = i;
-        }
-      }
-    }
+    void write(uint8_t c);
 
+    uint16_t rxBufferOverruns();
+    uint16_t rxHardwareOverruns();
 
     private:
     void printNumber(unsigned long, uint8_t);
@@ -39,6 +39,8 @@
 #include "watchdog.h"
 #include "ConfigurationStore.h"
 #include "lifetime_stats.h"
+#include "temp_log.h"
+#include "power_resume.h"
 #include "electronics_test.h"
 #include "language.h"
 #include "pins_arduino.h"
@@ -77,7 +79,7 @@
 // M105 - Read current temp
 // M106 - Fan on
 // M107 - Fan off
-// M109 - Wait for extruder current temp to reach target temp.
+// M109 - Wait for extruder current temp to reach target temp. With HEAT_WAIT_DEFERRED the first move that extrudes waits for heating up.
 // M114 - Display current position
 
 //Custom M Codes
@@ -95,6 +97,7 @@
 // M29  - Stop SD write
 // M30  - Delete file from SD (M30 filename.g)
 // M31  - Output time since last M109 or SD card start to serial
+// M34  - Set SD file sort order (M34 S0 directory order, S1 by name, S2 by date, newest first)
 // M42  - Change pin status via gcode Use M42 Px Sy to set pin x to value y, when omitting Px the onboard led will be used.
 // M80  - Turn on Power Supply
 // M81  - Turn off Power Supply
@@ -113,7 +116,9 @@
 // M128 - EtoP Open (BariCUDA EtoP = electricity to air pressure transducer by jmil)
 // M129 - EtoP Closed (BariCUDA EtoP = electricity to air pressure transducer by jmil)
 // M140 - Set bed target temp
-// M190 - Wait for bed current temp to reach target temp.
+// M155 - Report the temperatures every S<seconds> without being asked, S0 stops the reports
+// M156 - Send the temperature log
+// M190 - Wait for bed current temp to reach target temp. With HEAT_WAIT_DEFERRED the first move that extrudes waits.
 // M200 - Set filament diameter
 // M201 - Set max acceleration in units/s^2 for print moves (M201 X1000 Y1000)
 // M202 - Set max acceleration in units/s^2 for travel moves (M202 X1000 Y1000) Unused in Marlin!!
@@ -132,7 +137,7 @@
 // M300 - Play beepsound S<frequency Hz> P<duration ms>
 // M301 - Set PID parameters P I and D
 // M302 - Allow cold extrudes, or set the minimum extrude S<temperature>.
-// M303 - PID relay autotune S<temperature> sets the target temperature. (default target temperature = 150C)
+// M303 - PID relay autotune S<temperature> sets the target temperature. (default target temperature = 150C) F<mm/sec> also measures Kc by extruding.
 // M304 - Set bed PID parameters P I and D
 // M400 - Finish all moves
 // M401 - Cancel as many moves as possible
@@ -149,6 +154,7 @@
 // M923 - Select file and start printing directly (can be used from other SD file)
 // M928 - Start SD logging (M928 filename.g) - ended by M29
 // M999 - Restart after being stopped by error
+// M1000 - Resume the SD print that was interrupted by a power failure
 
 //Stepper Movement Variables
 
@@ -236,13 +242,17 @@ static float delta[3] = {0.0, 0.0, 0.0};
 #endif
 static float offset[3] = {0.0, 0.0, 0.0};
 static bool home_all_axis = true;
-static float feedrate = 1500.0, next_feedrate, saved_feedrate;
+float feedrate = 1500.0;
+static float next_feedrate, saved_feedrate;
 static long gcode_N, gcode_LastN, Stopped_gcode_LastN = 0;
 
 static bool relative_mode = false;  //Determines Absolute or Relative Coordinates
 
 static char cmdbuffer[BUFSIZE][MAX_CMD_SIZE];
 static bool fromsd[BUFSIZE];
+#ifdef POWER_LOSS_RESUME
+static uint32_t sdFilePos[BUFSIZE]; //File position of the line of each command from SD.
+#endif
 static int bufindr = 0;
 static int bufindw = 0;
 static int buflen = 0;
@@ -250,6 +260,9 @@ static int buflen = 0;
 static char serial_char;
 static int serial_count = 0;
 static boolean comment_mode = false;
+#ifndef AT90USB
+static uint16_t reported_rx_overruns = 0;
+#endif
 static char *strchr_pointer; // just a pointer to find chars in the cmd string like X, Y, Z, E, etc
 
 const int sensitive_pins[] = SENSITIVE_PINS; // Sensitive pin list for M42
@@ -267,6 +280,12 @@ unsigned long stoptime=0;
 
 static uint8_t tmp_extruder;
 
+#define HEAT_WAIT_BED _BV(7)
+#ifdef HEAT_WAIT_DEFERRED
+//Heaters an M109 or M190 did not wait for yet, bit e for extruder e and HEAT_WAIT_BED for the bed.
+//Only heating up is deferred, an M109 that cools down waits right away.
+static uint8_t heat_wait_pending;
+#endif
 
 uint8_t Stopped = false;
 
@@ -313,6 +332,9 @@ void clear_command_queue()
         bufindw = (bufindr + 1)%BUFSIZE;
         buflen = 1;
     }
+#ifdef HEAT_WAIT_DEFERRED
+    heat_wait_pending = 0;
+#endif
 }
 
 //adds an command to the main command buffer
@@ -466,6 +488,9 @@ void setup()
   // loads data from EEPROM if available else uses defaults (and resets step acceleration rate)
   Config_RetrieveSettings();
   lifetime_stats_init();
+#ifdef POWER_LOSS_RESUME
+  power_resume_init();
+#endif
   tp_init();    // Initialize temperature loop
   plan_init();  // Initialize planner;
   watchdog_init();
@@ -496,14 +521,11 @@ void loop()
         if(strstr_P(cmdbuffer[bufindr], PSTR("M29")) == NULL)
         {
           card.write_command(cmdbuffer[bufindr]);
+          //Uploaded lines were acknowledged by get_command when they were received.
           if(card.logging)
           {
             process_commands();
           }
-          else
-          {
-            SERIAL_PROTOCOLLNPGM(MSG_OK);
-          }
         }
         else
         {
@@ -513,7 +535,16 @@ void loop()
       }
       else
       {
+        #ifdef POWER_LOSS_RESUME
+        if (fromsd[bufindr])
+          plan_set_file_position(sdFilePos[bufindr]);
+        #endif
         process_commands();
+        #ifdef HEAT_WAIT_DEFERRED
+        //The SD print ended before a move waited for the heaters, a later manual move must not wait for them.
+        if (fromsd[bufindr] && !card.sdprinting && (buflen <= 1 || !fromsd[(bufindr + 1)%BUFSIZE]))
+          heat_wait_pending = 0;
+        #endif
       }
     #else
       process_commands();
@@ -523,6 +554,9 @@ void loop()
       buflen = (buflen-1);
       bufindr = (bufindr + 1)%BUFSIZE;
     }
+    //No more commands to merge a held back move with, so send it to the planner.
+    if (buflen == 0)
+      plan_flush_coalesced();
   }
   //check heater every n milliseconds
   manage_heater();
@@ -530,10 +564,37 @@ void loop()
   checkHitEndstops();
   lcd_update();
   lifetime_stats_tick();
+  #ifdef POWER_LOSS_RESUME
+  power_resume_tick();
+  #endif
+  #if defined(SDSUPPORT) && USE_BLOCK_PREFETCH
+  //Read the next block of the print file in small parts, so get_command does not have to wait for the card.
+  card.prefetch();
+  #endif
+  #if defined(SDSUPPORT) && defined(SD_GCODE_META_INDEX)
+  card.metaIndexTick();
+  #endif
+  #if defined(SDSUPPORT) && defined(SD_PREHEAT_LOOKAHEAD)
+  card.preheatTick();
+  #endif
 }
 
 void get_command()
 {
+#ifndef AT90USB
+  //Report lost serial characters, the host will see a checksum or line number error for these as well.
+  uint16_t buffer_overruns = MYSERIAL.rxBufferOverruns();
+  uint16_t hardware_overruns = MYSERIAL.rxHardwareOverruns();
+  if (buffer_overruns + hardware_overruns != reported_rx_overruns)
+  {
+    reported_rx_overruns = buffer_overruns + hardware_overruns;
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPGM("Serial RX overrun, buffer:");
+    SERIAL_ECHO(buffer_overruns);
+    SERIAL_ECHOPGM(" hardware:");
+    SERIAL_ECHOLN(hardware_overruns);
+  }
+#endif
   while( MYSERIAL.available() > 0  && buflen < BUFSIZE) {
     serial_char = MYSERIAL.read();
     if(serial_char == '\n' ||
@@ -632,6 +693,11 @@ void get_command()
         strchr_pointer = strchr(cmdbuffer[bufindw], 'M');
         if (strtol(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL, 10) != 105)
             lastSerialCommandTime = millis();
+#endif
+#ifdef SDSUPPORT
+        //Acknowledge a line of an upload right away, the host sends the next line while this one is written to the file.
+        if(card.saving && !card.logging && strstr_P(cmdbuffer[bufindw], PSTR("M29")) == NULL)
+          SERIAL_PROTOCOLLNPGM(MSG_OK);
 #endif
         bufindw = (bufindw + 1)%BUFSIZE;
         buflen += 1;
@@ -660,19 +726,20 @@ void get_command()
   }
   static uint32_t endOfLineFilePosition = 0;
   while( !card.eof()  && buflen < BUFSIZE) {
-    int16_t n=card.get();
+#ifdef POWER_LOSS_RESUME
+    sdFilePos[bufindw] = card.getFilePos();
+#endif
+    int16_t len = card.getLine(cmdbuffer[bufindw], MAX_CMD_SIZE);
     if (card.errorCode())
     {
         if (!card.sdInserted)
         {
             card.release();
-            serial_count = 0;
             return;
         }
 
         //On an error, reset the error, reset the file position and try again.
         card.clearError();
-        serial_count = 0;
         //Screw it, if we are near the end of a file with an error, act if the file is finished. Hopefully preventing the hang at the end.
         if (endOfLineFilePosition > card.getFileSize() - 512)
             card.sdprinting = false;
@@ -681,47 +748,29 @@ void get_command()
         return;
     }
 
-    serial_char = (char)n;
-    if(serial_char == '\n' ||
-       serial_char == '\r' ||
-       (serial_char == ':' && comment_mode == false) ||
-       serial_count >= (MAX_CMD_SIZE - 1)||n==-1)
+    if (len > 0)
     {
-      if(card.eof() || n==-1){
-        SERIAL_PROTOCOLLNPGM(MSG_FILE_PRINTED);
-        stoptime=millis();
-        char time[30];
-        unsigned long t=(stoptime-starttime)/1000;
-        int hours, minutes;
-        minutes=(t/60)%60;
-        hours=t/60/60;
-        sprintf_P(time, PSTR("%i hours %i minutes"),hours, minutes);
-        SERIAL_ECHO_START;
-        SERIAL_ECHOLN(time);
-        lcd_setstatus(time);
-        card.printingHasFinished();
-        card.checkautostart(true);
-
-      }
-      if(!serial_count)
-      {
-        comment_mode = false; //for new command
-        return; //if empty line
-      }
-      cmdbuffer[bufindw][serial_count] = 0; //terminate string
-//      if(!comment_mode){
-        fromsd[bufindw] = true;
-        buflen += 1;
-        bufindw = (bufindw + 1)%BUFSIZE;
-//      }
-      comment_mode = false; //for new command
-      serial_count = 0; //clear buffer
+      fromsd[bufindw] = true;
+      buflen += 1;
+      bufindw = (bufindw + 1)%BUFSIZE;
       endOfLineFilePosition = card.getFilePos();
     }
-    else
+    if (card.eof() || len < 0)
     {
-      if(serial_char == ';') comment_mode = true;
-      if(!comment_mode) cmdbuffer[bufindw][serial_count++] = serial_char;
+      SERIAL_PROTOCOLLNPGM(MSG_FILE_PRINTED);
+      stoptime=millis();
+      char time[30];
+      unsigned long t=(stoptime-starttime)/1000;
+      int hours, minutes;
+      minutes=(t/60)%60;
+      hours=t/60/60;
+      sprintf_P(time, PSTR("%i hours %i minutes"),hours, minutes);
+      SERIAL_ECHO_START;
+      SERIAL_ECHOLN(time);
+      lcd_setstatus(time);
+      card.printingHasFinished();
+      card.checkautostart(true);
+      return;
     }
   }
 
@@ -887,6 +936,123 @@ static void homeaxis(int axis) {
 }
 #define HOMEAXIS(LETTER) homeaxis(LETTER##_AXIS)
 
+//Wait until the heaters reach their targets, bit e of heaters for extruder e and HEAT_WAIT_BED for the bed.
+//The extruders in cooling wait to cool down, the bed only heats up.
+static void wait_for_heaters(uint8_t heaters, uint8_t cooling)
+{
+  uint8_t hotends = heaters & ~HEAT_WAIT_BED;
+  unsigned long codenum = millis();
+  #ifdef TEMP_RESIDENCY_TIME
+  long residencyStart = -1;
+  #endif
+
+  if (heaters & HEAT_WAIT_BED)
+    LCD_MESSAGEPGM(MSG_BED_HEATING);
+  else
+    LCD_MESSAGEPGM(MSG_HEATING);
+  while(true)
+  {
+    bool bed_done = true;
+    #if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
+    if ((heaters & HEAT_WAIT_BED) && current_temperature_bed < target_temperature_bed - TEMP_WINDOW)
+      bed_done = false;
+    #endif
+    bool hotends_done = true;
+    uint8_t report_extruder = active_extruder;
+    #ifdef TEMP_RESIDENCY_TIME
+    /* The hotends have to stay within TEMP_HYSTERESIS for TEMP_RESIDENCY_TIME, the timer starts when all are within TEMP_WINDOW
+      and restarts when one falls outside the hysteresis again. */
+    bool reached = true;
+    bool lost = false;
+    #endif
+    for(int8_t e=EXTRUDERS-1; e>=0; e--)
+    {
+      if (!(hotends & _BV(e)))
+        continue;
+      report_extruder = e;
+      bool target_direction = !(cooling & _BV(e));
+      #ifdef TEMP_RESIDENCY_TIME
+      if (target_direction ? (degHotend(e) < degTargetHotend(e) - TEMP_WINDOW) : (degHotend(e) > degTargetHotend(e) + TEMP_WINDOW))
+        reached = false;
+      if (fabs(degHotend(e) - degTargetHotend(e)) > TEMP_HYSTERESIS && (!target_direction || !CooldownNoWait))
+        lost = true;
+      #else
+      if (target_direction ? isHeatingHotend(e) : (isCoolingHotend(e) && (CooldownNoWait==false)))
+        hotends_done = false;
+      #endif
+    }
+    #ifdef TEMP_RESIDENCY_TIME
+    if (hotends)
+    {
+      if ((residencyStart == -1 && reached) || (residencyStart > -1 && lost))
+        residencyStart = millis();
+      hotends_done = residencyStart > -1 && ((unsigned long)(millis() - residencyStart)) >= (TEMP_RESIDENCY_TIME * 1000UL);
+    }
+    #endif
+    if (bed_done && hotends_done)
+      break;
+    printing_state = bed_done ? PRINT_STATE_HEATING : PRINT_STATE_HEATING_BED;
+
+    if( (millis() - codenum) > 1000UL )
+    { //Print Temp Reading and remaining time every 1 second while heating up/cooling down
+      SERIAL_PROTOCOLPGM("T:");
+      SERIAL_PROTOCOL_F(degHotend(report_extruder),1);
+      SERIAL_PROTOCOLPGM(" E:");
+      SERIAL_PROTOCOL((int)report_extruder);
+      #if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
+      if (heaters & HEAT_WAIT_BED)
+      {
+        SERIAL_PROTOCOLPGM(" B:");
+        SERIAL_PROTOCOL_F(degBed(),1);
+      }
+      #endif
+      #ifdef TEMP_RESIDENCY_TIME
+      if (hotends)
+      {
+        SERIAL_PROTOCOLPGM(" W:");
+        if(residencyStart > -1)
+          SERIAL_PROTOCOLLN(((TEMP_RESIDENCY_TIME * 1000UL) - (millis() - residencyStart)) / 1000UL);
+        else
+          SERIAL_PROTOCOLLNPGM("?");
+      }else{
+        SERIAL_PROTOCOLLN("");
+      }
+      #else
+      SERIAL_PROTOCOLLN("");
+      #endif
+      codenum = millis();
+    }
+    manage_heater();
+    manage_inactivity();
+    lcd_update();
+    lifetime_stats_tick();
+  }
+  printing_state = PRINT_STATE_NORMAL;
+  if (heaters & HEAT_WAIT_BED)
+    LCD_MESSAGEPGM(MSG_BED_DONE);
+  if (hotends)
+  {
+    LCD_MESSAGEPGM(MSG_HEATING_COMPLETE);
+    starttime=millis();
+  }
+  previous_millis_cmd = millis();
+}
+
+#ifdef HEAT_WAIT_DEFERRED
+//Called before a move extrudes, waits for the heaters an M109 or M190 left heating.
+//The bed and all hotends heat at the same time, and the moves queued before keep running.
+static void heat_wait_finish()
+{
+  if (!heat_wait_pending)
+    return;
+  //A held back travel move would otherwise only run after the wait.
+  plan_flush_coalesced();
+  uint8_t heaters = heat_wait_pending;
+  heat_wait_pending = 0;
+  wait_for_heaters(heaters, 0);
+}
+#endif
+
 void process_commands()
 {
   unsigned long codenum; //throw away variable
@@ -901,6 +1067,10 @@ void process_commands()
     case 1: // G1
       if(Stopped == false) {
         get_coordinates(); // For X Y Z E F
+        #ifdef HEAT_WAIT_DEFERRED
+        if (destination[E_AXIS] > current_position[E_AXIS])
+          heat_wait_finish();
+        #endif
         prepare_move();
         //ClearToSend();
         return;
@@ -909,12 +1079,20 @@ void process_commands()
     case 2: // G2  - CW ARC
       if(Stopped == false) {
         get_arc_coordinates();
+        #ifdef HEAT_WAIT_DEFERRED
+        if (destination[E_AXIS] > current_position[E_AXIS])
+          heat_wait_finish();
+        #endif
         prepare_arc_move(true);
         return;
       }
     case 3: // G3  - CCW ARC
       if(Stopped == false) {
         get_arc_coordinates();
+        #ifdef HEAT_WAIT_DEFERRED
+        if (destination[E_AXIS] > current_position[E_AXIS])
+          heat_wait_finish();
+        #endif
         prepare_arc_move(false);
         return;
       }
@@ -969,6 +1147,9 @@ void process_commands()
         float oldFeedrate = feedrate;
         feedrate=retract_recover_feedrate;
         retracted=false;
+        #ifdef HEAT_WAIT_DEFERRED
+        heat_wait_finish();
+        #endif
         prepare_move();
         feedrate = oldFeedrate;
       }
@@ -1142,7 +1323,13 @@ void process_commands()
       relative_mode = true;
       break;
     case 92: // G92
+      #ifdef POWER_LOSS_RESUME
+      // The resume point is found by undoing the queued moves from the current position, which only works when
+      // they are all in the same E coordinates.
+      if(!code_seen(axis_codes[E_AXIS]) || card.sdprinting)
+      #else
       if(!code_seen(axis_codes[E_AXIS]))
+      #endif
         st_synchronize();
       for(int8_t i=0; i < NUM_AXIS; i++) {
         if(code_seen(axis_codes[i])) {
@@ -1300,6 +1487,15 @@ void process_commands()
       }
       card.openLogFile(strchr_pointer+5);
       break;
+#ifdef SD_SORT
+    case 34: //M34 - Set SD file sort order
+      if (code_seen('S'))
+        card.setSortMode(code_value_long());
+      SERIAL_ECHO_START;
+      SERIAL_ECHOPGM("SD sort mode:");
+      SERIAL_ECHOLN(int(card.getSortMode()));
+      break;
+#endif
 
 #endif //SDSUPPORT
 
@@ -1353,6 +1549,14 @@ void process_commands()
     case 140: // M140 set bed temp
       if (code_seen('S')) setTargetBed(code_value());
       break;
+    #ifdef TEMP_LOG
+    case 155: // M155 temperature auto report
+      temp_log_set_auto_report(code_seen('S') ? constrain(code_value(), 0, 255) : 1);
+      break;
+    case 156: // M156 send the temperature log
+      temp_log_dump();
+      break;
+    #endif
     case 105 : // M105
       if(setTargetedHotend(105)){
         break;
@@ -1387,8 +1591,6 @@ void process_commands()
       if(setTargetedHotend(109)){
         break;
       }
-      printing_state = PRINT_STATE_HEATING;
-      LCD_MESSAGEPGM(MSG_HEATING);
       #ifdef AUTOTEMP
         autotemp_enabled=false;
       #endif
@@ -1404,90 +1606,30 @@ void process_commands()
       #endif
 
       setWatch();
-      codenum = millis();
 
       /* See if we are heating up or cooling down */
       bool target_direction = isHeatingHotend(tmp_extruder); // true if heating, false if cooling
-
-      #ifdef TEMP_RESIDENCY_TIME
-        long residencyStart;
-        residencyStart = -1;
-        /* continue to loop until we have reached the target temp
-          _and_ until TEMP_RESIDENCY_TIME hasn't passed since we reached it */
-        while((residencyStart == -1) ||
-              (residencyStart >= 0 && (((unsigned int) (millis() - residencyStart)) < (TEMP_RESIDENCY_TIME * 1000UL))) ) {
-      #else
-        while ( target_direction ? (isHeatingHotend(tmp_extruder)) : (isCoolingHotend(tmp_extruder)&&(CooldownNoWait==false)) ) {
-      #endif //TEMP_RESIDENCY_TIME
-          if( (millis() - codenum) > 1000UL )
-          { //Print Temp Reading and remaining time every 1 second while heating up/cooling down
-            SERIAL_PROTOCOLPGM("T:");
-            SERIAL_PROTOCOL_F(degHotend(tmp_extruder),1);
-            SERIAL_PROTOCOLPGM(" E:");
-            SERIAL_PROTOCOL((int)tmp_extruder);
-            #ifdef TEMP_RESIDENCY_TIME
-              SERIAL_PROTOCOLPGM(" W:");
-              if(residencyStart > -1)
-              {
-                 codenum = ((TEMP_RESIDENCY_TIME * 1000UL) - (millis() - residencyStart)) / 1000UL;
-                 SERIAL_PROTOCOLLN( codenum );
-              }
-              else
-              {
-                 SERIAL_PROTOCOLLNPGM( "?" );
-              }
-            #else
-              SERIAL_PROTOCOLLN("");
-            #endif
-            codenum = millis();
-          }
-          manage_heater();
-          manage_inactivity();
-          lcd_update();
-          lifetime_stats_tick();
-        #ifdef TEMP_RESIDENCY_TIME
-            /* start/restart the TEMP_RESIDENCY_TIME timer whenever we reach target temp for the first time
-              or when current temp falls outside the hysteresis after target temp was reached */
-          if ((residencyStart == -1 &&  target_direction && (degHotend(tmp_extruder) >= (degTargetHotend(tmp_extruder)-TEMP_WINDOW))) ||
-              (residencyStart == -1 && !target_direction && (degHotend(tmp_extruder) <= (degTargetHotend(tmp_extruder)+TEMP_WINDOW))) ||
-              (residencyStart > -1 && labs(degHotend(tmp_extruder) - degTargetHotend(tmp_extruder)) > TEMP_HYSTERESIS && (!target_direction || !CooldownNoWait)) )
-          {
-            residencyStart = millis();
-          }
-        #endif //TEMP_RESIDENCY_TIME
+      #ifdef HEAT_WAIT_DEFERRED
+        if (target_direction)
+        {
+          heat_wait_pending |= _BV(tmp_extruder);
+        }else{
+          heat_wait_pending &=~_BV(tmp_extruder);
+          wait_for_heaters(_BV(tmp_extruder), _BV(tmp_extruder));
         }
-        LCD_MESSAGEPGM(MSG_HEATING_COMPLETE);
-        starttime=millis();
-        previous_millis_cmd = millis();
+      #else
+        wait_for_heaters(_BV(tmp_extruder), target_direction ? 0 : _BV(tmp_extruder));
+      #endif
       }
       break;
     case 190: // M190 - Wait for bed heater to reach target.
     #if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
-        printing_state = PRINT_STATE_HEATING_BED;
-        LCD_MESSAGEPGM(MSG_BED_HEATING);
         if (code_seen('S')) setTargetBed(code_value());
-        codenum = millis();
-        while(current_temperature_bed < target_temperature_bed - TEMP_WINDOW)
-        {
-          if(( millis() - codenum) > 1000 ) //Print Temp Reading every 1 second while heating up.
-          {
-            float tt=degHotend(active_extruder);
-            SERIAL_PROTOCOLPGM("T:");
-            SERIAL_PROTOCOL(tt);
-            SERIAL_PROTOCOLPGM(" E:");
-            SERIAL_PROTOCOL((int)active_extruder);
-            SERIAL_PROTOCOLPGM(" B:");
-            SERIAL_PROTOCOL_F(degBed(),1);
-            SERIAL_PROTOCOLLN("");
-            codenum = millis();
-          }
-          manage_heater();
-          manage_inactivity();
-          lcd_update();
-          lifetime_stats_tick();
-        }
-        LCD_MESSAGEPGM(MSG_BED_DONE);
-        previous_millis_cmd = millis();
+        #ifdef HEAT_WAIT_DEFERRED
+        heat_wait_pending |= HEAT_WAIT_BED;
+        #else
+        wait_for_heaters(HEAT_WAIT_BED, 0);
+        #endif
     #endif
         break;
 
@@ -1955,7 +2097,11 @@ void process_commands()
           temp=70;
       if (code_seen('S')) temp=code_value();
       if (code_seen('C')) c=code_value();
-      PID_autotune(temp, e, c);
+      float f=0;
+      #ifdef PID_ADD_EXTRUSION_RATE
+      if (code_seen('F')) f=code_value();
+      #endif
+      PID_autotune(temp, e, c, f);
     }
     break;
     case 400: // M400 finish all moves
@@ -2331,6 +2477,15 @@ void process_commands()
       gcode_LastN = Stopped_gcode_LastN;
       FlushSerialRequestResend();
     break;
+#ifdef POWER_LOSS_RESUME
+    case 1000: // M1000: Resume the SD print that was interrupted by a power failure
+      #ifdef HEAT_WAIT_DEFERRED
+      // The M190 and M109 queued by the first M1000 did not wait, the travel back to the print must not start before they are done.
+      heat_wait_finish();
+      #endif
+      power_resume_continue();
+      break;
+#endif
 #ifdef ENABLE_ULTILCD2
     case 10000://M10000 - Clear the whole LCD
         lcd_lib_clear();
@@ -2644,7 +2799,7 @@ void prepare_move()
       plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate/60, active_extruder);
   }
   else {
-    plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate*feedmultiply/60/100.0, active_extruder);
+    plan_buffer_line_coalesced(current_position, destination, feedrate*feedmultiply/60/100.0, active_extruder);
   }
 #endif
   for(int8_t i=0; i < NUM_AXIS; i++) {
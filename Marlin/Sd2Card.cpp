@@ -22,6 +22,20 @@
 #ifdef SDSUPPORT
 #include "Sd2Card.h"
 //------------------------------------------------------------------------------
+/** Add one byte to a CRC16-CCITT (polynomial 0X1021) without a table.
+ *
+ * Short enough to run while the SPI hardware receives the next byte.
+ */
+static inline __attribute__((always_inline))
+uint16_t crcUpdate(uint16_t crc, uint8_t data) {
+  crc = (crc >> 8) | (crc << 8);
+  crc ^= data;
+  crc ^= (crc & 0XFF) >> 4;
+  crc ^= crc << 12;
+  crc ^= (crc & 0XFF) << 5;
+  return crc;
+}
+//------------------------------------------------------------------------------
 #ifndef SOFTWARE_SPI
 // functions for hardware SPI
 //------------------------------------------------------------------------------
@@ -46,18 +60,26 @@ static uint8_t spiRec() {
   return SPDR;
 }
 //------------------------------------------------------------------------------
-/** SPI read data - only one call so force inline */
+/** SPI read data and add it to \a crc - only a few calls so force inline
+ *
+ * The CRC of each byte is computed while the next byte is received.
+ */
 static inline __attribute__((always_inline))
-void spiRead(uint8_t* buf, uint16_t nbyte) {
-  if (nbyte-- == 0) return;
+uint16_t spiReadCrc(uint8_t* buf, uint16_t nbyte, uint16_t crc) {
+  uint8_t b;
+  if (nbyte-- == 0) return crc;
   SPDR = 0XFF;
   for (uint16_t i = 0; i < nbyte; i++) {
     while (!(SPSR & (1 << SPIF))) { /* Intentionally left empty */ }
-    buf[i] = SPDR;
+    b = SPDR;
     SPDR = 0XFF;
+    buf[i] = b;
+    crc = crcUpdate(crc, b);
   }
   while (!(SPSR & (1 << SPIF))) { /* Intentionally left empty */ }
-  buf[nbyte] = SPDR;
+  b = SPDR;
+  buf[nbyte] = b;
+  return crcUpdate(crc, b);
 }
 //------------------------------------------------------------------------------
 /** SPI send a byte */
@@ -110,11 +132,13 @@ static uint8_t spiRec() {
   return data;
 }
 //------------------------------------------------------------------------------
-/** Soft SPI read data */
-static void spiRead(uint8_t* buf, uint16_t nbyte) {
+/** Soft SPI read data and add it to \a crc */
+static uint16_t spiReadCrc(uint8_t* buf, uint16_t nbyte, uint16_t crc) {
   for (uint16_t i = 0; i < nbyte; i++) {
     buf[i] = spiRec();
+    crc = crcUpdate(crc, buf[i]);
   }
+  return crc;
 }
 //------------------------------------------------------------------------------
 /** Soft SPI send byte */
@@ -230,6 +254,7 @@ void Sd2Card::chipSelectLow() {
  */
 bool Sd2Card::erase(uint32_t firstBlock, uint32_t lastBlock) {
   csd_t csd;
+  readStreamEnd();
   if (!readCSD(&csd)) goto fail;
   // check for single block erase
   if (!csd.v1.erase_blk_en) {
@@ -286,6 +311,8 @@ bool Sd2Card::eraseSingleBlockEnable() {
 bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
   errorCode_ = type_ = 0;
   chipSelectPin_ = chipSelectPin;
+  streamBlock_ = STREAM_NONE;
+  streamPos_ = -1;
   // 16-bit init start time allows over a minute
   uint16_t t0 = (uint16_t)millis();
   uint32_t arg;
@@ -374,6 +401,7 @@ bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
  */
 bool Sd2Card::readBlock(uint32_t blockNumber, uint8_t* dst) {
   uint8_t retryCnt = 3;
+  readStreamEnd();
   // use address if not SDHC card
   if (type()!= SD_CARD_TYPE_SDHC) blockNumber <<= 9;
  retry2:
@@ -400,6 +428,41 @@ bool Sd2Card::readBlock(uint32_t blockNumber, uint8_t* dst) {
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Read a 512 byte block using a multiple block read sequence.
+ *
+ * Consecutive calls for consecutive blocks are served from one CMD18
+ * sequence.  A block partly read by readStreamPart() is completed into
+ * \a dst.  Any other block number ends the open sequence and starts a
+ * new one.  If the sequence can not be started or a block fails to read
+ * the block is read again with readBlock().
+ *
+ * \param[in] blockNumber Logical block to be read.
+ * \param[out] dst Pointer to the location that will receive the data.
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool Sd2Card::readBlockStream(uint32_t blockNumber, uint8_t* dst) {
+  if (streamBlock_ != blockNumber) {
+    readStreamEnd();
+    if (!readStart(blockNumber)) goto fallback;
+    streamBlock_ = blockNumber;
+  }
+  if (streamPos_ >= 0) {
+    // finish the block started by readStreamPart(), dst must be the same
+    if (readStreamPart(dst, 512) > 0) return true;
+    goto fallback;
+  }
+  if (!readData(dst)) goto fallback;
+  streamBlock_++;
+  return true;
+
+ fallback:
+  readStreamEnd();
+  errorCode_ = 0;
+  return readBlock(blockNumber, dst);
+}
+//------------------------------------------------------------------------------
 /** Read one data block in a multiple block read sequence
  *
  * \param[in] dst Pointer to the location for the data to be read.
@@ -412,48 +475,6 @@ bool Sd2Card::readData(uint8_t *dst) {
   return readData(dst, 512);
 }
 
-static const uint16_t crctab[] PROGMEM = {
-  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
-  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
-  0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
-  0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
-  0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
-  0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
-  0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
-  0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
-  0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
-  0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
-  0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
-  0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
-  0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
-  0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
-  0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
-  0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
-  0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
-  0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
-  0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
-  0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
-  0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
-  0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-  0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
-  0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
-  0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
-  0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
-  0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
-  0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
-  0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
-  0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
-  0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
-  0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
-};
-static uint16_t CRC_CCITT(const uint8_t* data, size_t n) {
-  uint16_t crc = 0;
-  for (size_t i = 0; i < n; i++) {
-    crc = pgm_read_word(&crctab[(crc >> 8 ^ data[i]) & 0XFF]) ^ (crc << 8);
-  }
-  return crc;
-}
-
 //------------------------------------------------------------------------------
 bool Sd2Card::readData(uint8_t* dst, uint16_t count) {
   // wait for start block token
@@ -469,11 +490,10 @@ bool Sd2Card::readData(uint8_t* dst, uint16_t count) {
     goto fail;
   }
   // transfer data
-  spiRead(dst, count);
-
-  // discard CRC
 {
-    uint16_t calcCrc = CRC_CCITT(dst, count);
+    uint16_t calcCrc = spiReadCrc(dst, count, 0);
+
+    // check CRC
     uint16_t recvCrc = spiRec() << 8;
     recvCrc |= spiRec();
     if (calcCrc != recvCrc)
@@ -498,6 +518,7 @@ bool Sd2Card::readData(uint8_t* dst, uint16_t count) {
 /** read CID or CSR register */
 bool Sd2Card::readRegister(uint8_t cmd, void* buf) {
   uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
+  readStreamEnd();
   if (cardCommand(cmd, 0)) {
     error(SD_CARD_ERROR_READ_REG);
     goto fail;
@@ -552,6 +573,141 @@ bool Sd2Card::readStop() {
   return false;
 }
 //------------------------------------------------------------------------------
+/** End the multiple block read sequence started by readBlockStream(), if any.
+ *
+ * Called before every other card access.  A failing stop is ignored and
+ * leaves errorCode() as it was, the next command is sent after the card
+ * is no longer busy and falls back to single block reads if it fails.
+ */
+void Sd2Card::readStreamEnd() {
+  if (streamBlock_ == STREAM_NONE) return;
+  streamBlock_ = STREAM_NONE;
+  streamPos_ = -1;
+  uint8_t errorCode = errorCode_;
+  readStop();
+  errorCode_ = errorCode;
+}
+//------------------------------------------------------------------------------
+/** Read part of a block in a multiple block read sequence, without a
+ * 512 byte buffer.
+ *
+ * The open sequence is continued when it is at or before \a offset in
+ * \a blockNumber, otherwise a new sequence is started.  Skipped bytes are
+ * only used for the CRC.  The rest of a block must be read before the
+ * next block is.
+ *
+ * \param[in] blockNumber Logical block to be read.
+ * \param[in] offset Position in the block of the first byte.
+ * \param[out] dst Pointer to the location for the data.
+ * \param[in] count Number of bytes, up to the end of the block.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.  On failure the
+ * sequence is ended.
+ */
+bool Sd2Card::readStreamData(uint32_t blockNumber, uint16_t offset, uint8_t* dst, uint16_t count) {
+  uint16_t recvCrc;
+  if (streamBlock_ != blockNumber || streamPos_ > (int16_t)offset) {
+    readStreamEnd();
+    if (!readStart(blockNumber)) goto fail;
+    streamBlock_ = blockNumber;
+  }
+  chipSelectLow();
+  if (streamPos_ < 0) {
+    // wait for start block token
+    uint16_t t0 = millis();
+    while ((status_ = spiRec()) == 0XFF) {
+      if (((uint16_t)millis() - t0) > SD_READ_TIMEOUT) {
+        error(SD_CARD_ERROR_READ_TIMEOUT);
+        goto fail;
+      }
+    }
+    if (status_ != DATA_START_BLOCK) {
+      error(SD_CARD_ERROR_READ);
+      goto fail;
+    }
+    streamPos_ = 0;
+    streamCrc_ = 0;
+  }
+  while (streamPos_ < (int16_t)offset) {
+    streamCrc_ = crcUpdate(streamCrc_, spiRec());
+    streamPos_++;
+  }
+  streamCrc_ = spiReadCrc(dst, count, streamCrc_);
+  streamPos_ += count;
+  if (streamPos_ < 512) {
+    chipSelectHigh();
+    return true;
+  }
+  recvCrc = spiRec() << 8;
+  recvCrc |= spiRec();
+  if (streamCrc_ != recvCrc) {
+    error(SD_CARD_ERROR_CRC);
+    goto fail;
+  }
+  chipSelectHigh();
+  streamBlock_++;
+  streamPos_ = -1;
+  return true;
+
+ fail:
+  chipSelectHigh();
+  readStreamEnd();
+  return false;
+}
+//------------------------------------------------------------------------------
+/** Read part of the next block of the open multiple block read sequence.
+ *
+ * Never waits for the card.  If the data start token is not there yet
+ * nothing is transferred.  Calls for one block must use the same \a dst.
+ *
+ * \param[out] dst Pointer to the 512 byte location for the block.
+ * \param[in] count Maximum number of data bytes to transfer in this call.
+ *
+ * \return 1 if the block is complete, 0 if more calls are needed or -1 if
+ * there is no open sequence or an error occurred.  On error the sequence
+ * is ended.
+ */
+int8_t Sd2Card::readStreamPart(uint8_t* dst, uint16_t count) {
+  uint16_t recvCrc;
+  if (streamBlock_ == STREAM_NONE) return -1;
+  chipSelectLow();
+  if (streamPos_ < 0) {
+    if ((status_ = spiRec()) == 0XFF) {
+      chipSelectHigh();
+      return 0;
+    }
+    if (status_ != DATA_START_BLOCK) {
+      error(SD_CARD_ERROR_READ);
+      goto fail;
+    }
+    streamPos_ = 0;
+    streamCrc_ = 0;
+  }
+  if (count > 512 - streamPos_) count = 512 - streamPos_;
+  streamCrc_ = spiReadCrc(dst + streamPos_, count, streamCrc_);
+  streamPos_ += count;
+  if (streamPos_ < 512) {
+    chipSelectHigh();
+    return 0;
+  }
+  recvCrc = spiRec() << 8;
+  recvCrc |= spiRec();
+  if (streamCrc_ != recvCrc) {
+    error(SD_CARD_ERROR_CRC);
+    goto fail;
+  }
+  chipSelectHigh();
+  streamBlock_++;
+  streamPos_ = -1;
+  return 1;
+
+ fail:
+  chipSelectHigh();
+  readStreamEnd();
+  return -1;
+}
+//------------------------------------------------------------------------------
 /**
  * Set the SPI clock rate.
  *
@@ -594,6 +750,7 @@ bool Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
+  readStreamEnd();
   // use address if not SDHC card
   if (type() != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD24, blockNumber)) {
@@ -670,6 +827,7 @@ bool Sd2Card::writeData(uint8_t token, const uint8_t* src) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
+  readStreamEnd();
   // send pre-erase count
   if (cardAcmd(ACMD23, eraseCount)) {
     error(SD_CARD_ERROR_ACMD23);
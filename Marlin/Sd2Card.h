@@ -156,7 +156,8 @@ uint8_t const SPI_SCK_PIN = SOFT_SPI_SCK_PIN;
 class Sd2Card {
  public:
   /** Construct an instance of Sd2Card. */
-  Sd2Card() : errorCode_(SD_CARD_ERROR_INIT_NOT_CALLED), type_(0) {}
+  Sd2Card() : errorCode_(SD_CARD_ERROR_INIT_NOT_CALLED), type_(0),
+    streamBlock_(STREAM_NONE), streamPos_(-1) {}
   uint32_t cardSize();
   bool erase(uint32_t firstBlock, uint32_t lastBlock);
   bool eraseSingleBlockEnable();
@@ -180,6 +181,7 @@ class Sd2Card {
   bool init(uint8_t sckRateID = SPI_FULL_SPEED,
     uint8_t chipSelectPin = SD_CHIP_SELECT_PIN);
   bool readBlock(uint32_t block, uint8_t* dst);
+  bool readBlockStream(uint32_t block, uint8_t* dst);
   /**
    * Read a card's CID register. The CID contains card identification
    * information such as Manufacturer ID, Product name, Product serial
@@ -206,6 +208,11 @@ class Sd2Card {
   bool readData(uint8_t *dst);
   bool readStart(uint32_t blockNumber);
   bool readStop();
+  void readStreamEnd();
+  int8_t readStreamPart(uint8_t* dst, uint16_t count);
+  bool readStreamData(uint32_t blockNumber, uint16_t offset, uint8_t* dst, uint16_t count);
+  /** \return The next block of the open multiple block read sequence. */
+  uint32_t streamBlock() const {return streamBlock_;}
   bool setSckRate(uint8_t sckRateID);
   /** Return the card type: SD V1, SD V2 or SDHC
    * \return 0 - SD V1, 1 - SD V2, or 3 - SDHC.
@@ -222,6 +229,12 @@ class Sd2Card {
   uint8_t spiRate_;
   uint8_t status_;
   uint8_t type_;
+  // next block of an open multiple block read or STREAM_NONE
+  uint32_t streamBlock_;
+  // data bytes of streamBlock_ read by readStreamPart() or readStreamData(), -1 before the token
+  int16_t streamPos_;
+  uint16_t streamCrc_;
+  static uint32_t const STREAM_NONE = 0XFFFFFFFF;
   // private functions
   uint8_t cardAcmd(uint8_t cmd, uint32_t arg) {
     cardCommand(CMD55, 0);
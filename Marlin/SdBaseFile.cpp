@@ -30,13 +30,21 @@ void (*SdBaseFile::dateTime_)(uint16_t* date, uint16_t* time) = 0;
 //------------------------------------------------------------------------------
 // add a cluster to a file
 bool SdBaseFile::addCluster() {
-  if (!vol_->allocContiguous(1, &curCluster_)) goto fail;
+  uint32_t count = 1;
+  if (flags_ & F_FILE_ALLOC_AHEAD) {
+    count = ALLOC_AHEAD_CLUSTERS;
+    // no contiguous run left, allocate one cluster at a time
+    if (!vol_->allocContiguous(count, &curCluster_)) count = 1;
+  }
+  if (count == 1 && !vol_->allocContiguous(1, &curCluster_)) goto fail;
 
   // if first cluster of file link to directory entry
   if (firstCluster_ == 0) {
     firstCluster_ = curCluster_;
     flags_ |= F_FILE_DIR_DIRTY;
   }
+  // map the new run, the next clusters are found without the FAT
+  if (count > 1 && !vol_->extentMap(firstCluster_)) goto fail;
   return true;
 
  fail:
@@ -91,7 +99,12 @@ dir_t* SdBaseFile::cacheDirEntry(uint8_t action) {
  * Reasons for failure include no file is open or an I/O error.
  */
 bool SdBaseFile::close() {
-  bool rtn = sync();
+  bool rtn = true;
+  // free clusters that were allocated ahead but not written
+  if ((flags_ & F_FILE_ALLOC_AHEAD) && isFile() && (flags_ & O_WRITE)) {
+    rtn = truncate(fileSize_);
+  }
+  rtn = sync() && rtn;
   type_ = FAT_FILE_TYPE_CLOSED;
   return rtn;
 }
@@ -411,6 +424,20 @@ bool SdBaseFile::make83Name(const char* str, uint8_t* name, const char** ptr) {
   return false;
 }
 //------------------------------------------------------------------------------
+/** Map the file's cluster chain into the volume's run list.
+ *
+ * Reads and seeks in the mapped part of the file follow the chain without
+ * FAT reads, a contiguous file is read by block arithmetic only.  The
+ * volume holds one mapped file, writes to the FAT drop it.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool SdBaseFile::mapExtents() {
+  if (!isFile()) return false;
+  return vol_->extentMap(firstCluster_);
+}
+//------------------------------------------------------------------------------
 /** Make a new directory.
  *
  * \param[in] parent An open SdFat instance for the directory that will contain
@@ -693,6 +720,49 @@ bool SdBaseFile::open(SdBaseFile* dirFile,
   return false;
 }
 //------------------------------------------------------------------------------
+/** Open a file by the location of its directory entry.
+ *
+ * Opens a file without its directory, for example to continue with a file
+ * that was open before a reset.
+ *
+ * \param[in] vol The volume of the file.
+ *
+ * \param[in] block The block with the directory entry, from dirBlock().
+ *
+ * \param[in] index The index of the entry in \a block, from dirIndex().
+ *
+ * \param[in] oflag Values for \a oflag are constructed by a bitwise-inclusive
+ * OR of flags O_READ, O_WRITE, O_TRUNC, and O_SYNC.
+ *
+ * \return true for success or false for failure.
+ */
+bool SdBaseFile::openEntry(SdVolume* vol, uint32_t block, uint8_t index,
+  uint8_t oflag) {
+  dir_t* p;
+
+  // error if already open
+  if (isOpen() || !vol || index > 15) goto fail;
+
+  // don't open existing file if O_EXCL - user call error
+  if (oflag & O_EXCL) goto fail;
+  vol_ = vol;
+
+  // read entry into cache
+  if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) goto fail;
+  p = &vol_->cache()->dir[index];
+
+  // error if empty slot or '.' or '..'
+  if (p->name[0] == DIR_NAME_FREE ||
+      p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') {
+    goto fail;
+  }
+  // open cached entry
+  return openCachedEntry(index, oflag);
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
 /** Open a file by index.
  *
  * \param[in] dirFile An open SdFat instance for the directory.
@@ -1018,6 +1088,49 @@ bool SdBaseFile::printName() {
   return true;
 }
 //------------------------------------------------------------------------------
+// Find the raw device block for the current position, follow the cluster
+// chain when the position is at the start of a new cluster.
+bool SdBaseFile::curBlock(uint32_t* block) {
+  if (type_ == FAT_FILE_TYPE_ROOT_FIXED) {
+    *block = vol_->rootDirStart() + (curPosition_ >> 9);
+  } else {
+    uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+    if ((curPosition_ & 0X1FF) == 0 && blockOfCluster == 0) {
+      // start of new cluster
+      if (curPosition_ == 0) {
+        // use first cluster in file
+        curCluster_ = firstCluster_;
+      } else if (vol_->extentAdvance(firstCluster_, &curCluster_, 1)) {
+        // get next cluster from FAT
+        if (!vol_->fatGet(curCluster_, &curCluster_)) return false;
+      }
+    }
+    *block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+  }
+  return true;
+}
+#if USE_BLOCK_PREFETCH
+//------------------------------------------------------------------------------
+/** Read part of the block at the current position in the background.
+ *
+ * Used after readCached() to load the next block into the volume's
+ * prefetch buffer a few bytes per call.  Nothing is done at a cluster
+ * boundary if the next cluster needs a FAT read, see mapExtents().
+ */
+void SdBaseFile::prefetch() {
+  uint32_t cluster = curCluster_;
+  if (!isFile() || !(flags_ & O_READ) || curPosition_ >= fileSize_) return;
+  if ((curPosition_ & 0X1FF) == 0 && vol_->blockOfCluster(curPosition_) == 0) {
+    if (curPosition_ == 0) {
+      cluster = firstCluster_;
+    } else if (vol_->extentAdvance(firstCluster_, &cluster, 1)) {
+      return;
+    }
+  }
+  vol_->cachePrefetch(vol_->blockNumber(cluster, curPosition_));
+}
+#endif  // USE_BLOCK_PREFETCH
+//------------------------------------------------------------------------------
 /** Read the next byte from a file.
  *
  * \return For success read returns the next byte in the file as an int.
@@ -1058,22 +1171,7 @@ int16_t SdBaseFile::read(void* buf, uint16_t nbyte) {
   toRead = nbyte;
   while (toRead > 0) {
     offset = curPosition_ & 0X1FF;  // offset in block
-    if (type_ == FAT_FILE_TYPE_ROOT_FIXED) {
-      block = vol_->rootDirStart() + (curPosition_ >> 9);
-    } else {
-      uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
-      if (offset == 0 && blockOfCluster == 0) {
-        // start of new cluster
-        if (curPosition_ == 0) {
-          // use first cluster in file
-          curCluster_ = firstCluster_;
-        } else {
-          // get next cluster from FAT
-          if (!vol_->fatGet(curCluster_, &curCluster_)) goto fail;
-        }
-      }
-      block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
-    }
+    if (!curBlock(&block)) goto fail;
     uint16_t n = toRead;
 
     // amount to be read from current block
@@ -1098,6 +1196,108 @@ int16_t SdBaseFile::read(void* buf, uint16_t nbyte) {
   return -1;
 }
 //------------------------------------------------------------------------------
+/** Read the remainder of the current block without copying it.
+ *
+ * The block is read into the volume cache and the file position is moved
+ * to the end of the block, or to the end of the file.
+ *
+ * \param[out] data Set to the data at the old file position in the volume
+ * cache. The data stays valid until the cache is used for another block,
+ * which can be checked with readCachedValid().
+ *
+ * \return The number of bytes available at \a data, zero at end of file
+ * or -1 if an error occurs.
+ */
+int16_t SdBaseFile::readCached(const uint8_t** data) {
+  uint32_t block;  // raw device block number
+  uint16_t offset;
+  uint16_t n;
+
+  // error if not open or write only
+  if (!isOpen() || !(flags_ & O_READ)) goto fail;
+  if (curPosition_ >= fileSize_) return 0;
+
+  offset = curPosition_ & 0X1FF;
+  if (!curBlock(&block)) goto fail;
+#if USE_MULTI_BLOCK_READ
+  if (!vol_->cacheStreamBlock(block)) goto fail;
+#else  // USE_MULTI_BLOCK_READ
+  if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) goto fail;
+#endif  // USE_MULTI_BLOCK_READ
+
+  n = 512 - offset;
+  if (n > fileSize_ - curPosition_) n = fileSize_ - curPosition_;
+  *data = vol_->cache()->data + offset;
+  curPosition_ += n;
+  return n;
+
+ fail:
+  return -1;
+}
+#if USE_MULTI_BLOCK_READ
+//------------------------------------------------------------------------------
+/** Read data from the current block without using the volume cache.
+ *
+ * The data comes from the card's multiple block read sequence, or from the
+ * cache if it holds the block.  The block in the cache stays there, so a
+ * second file can be read ahead of a file read by readCached().
+ *
+ * \param[out] buf Pointer to the location that will receive the data.
+ *
+ * \param[in] nbyte Maximum number of bytes to read, less are read at the
+ * end of the block.
+ *
+ * \return The number of bytes read, zero at end of file or -1 if an error
+ * occurs.
+ */
+int16_t SdBaseFile::readStreamed(uint8_t* buf, uint16_t nbyte) {
+  uint32_t block;  // raw device block number
+  uint16_t offset;
+
+  // error if not open or write only
+  if (!isOpen() || !(flags_ & O_READ)) goto fail;
+  if (curPosition_ >= fileSize_) return 0;
+
+  offset = curPosition_ & 0X1FF;
+  if (nbyte > 512 - offset) nbyte = 512 - offset;
+  if (nbyte > fileSize_ - curPosition_) nbyte = fileSize_ - curPosition_;
+  if (!curBlock(&block)) goto fail;
+  if (block == vol_->cacheBlockNumber()) {
+    memcpy(buf, vol_->cache()->data + offset, nbyte);
+  } else {
+#if USE_BLOCK_PREFETCH
+    // the sequence moves to another block, a partly prefetched block is read again
+    if (!vol_->prefetchReady_) vol_->cachePrefetchClear();
+#endif  // USE_BLOCK_PREFETCH
+    if (!vol_->sdCard()->readStreamData(block, offset, buf, nbyte)) goto fail;
+  }
+  curPosition_ += nbyte;
+  return nbyte;
+
+ fail:
+  return -1;
+}
+#endif  // USE_MULTI_BLOCK_READ
+//------------------------------------------------------------------------------
+/** Check if data returned by readCached() is still in the volume cache.
+ *
+ * \return true if the block holding the byte before the current position
+ * is the block in the volume cache.
+ */
+bool SdBaseFile::readCachedValid() {
+  uint32_t position;
+  uint32_t block;
+
+  if (!isOpen() || curPosition_ == 0) return false;
+  position = curPosition_ - 1;
+  if (type_ == FAT_FILE_TYPE_ROOT_FIXED) {
+    block = vol_->rootDirStart() + (position >> 9);
+  } else {
+    block = vol_->clusterStartBlock(curCluster_) + vol_->blockOfCluster(position);
+  }
+  return block == vol_->cacheBlockNumber();
+}
+//------------------------------------------------------------------------------
 /** Read the next directory entry from a directory file.
  *
  * \param[out] dir The dir_t struct that will receive the data.
@@ -1480,6 +1680,7 @@ bool SdBaseFile::seekSet(uint32_t pos) {
     // advance from curPosition
     nNew -= nCur;
   }
+  nNew = vol_->extentAdvance(firstCluster_, &curCluster_, nNew);
   while (nNew--) {
     if (!vol_->fatGet(curCluster_, &curCluster_)) goto fail;
   }
@@ -1754,8 +1955,11 @@ int16_t SdBaseFile::write(const void* buf, uint16_t nbyte) {
           curCluster_ = firstCluster_;
         }
       } else {
-        uint32_t next;
-        if (!vol_->fatGet(curCluster_, &next)) goto fail;
+        uint32_t next = curCluster_;
+        if (vol_->extentAdvance(firstCluster_, &next, 1)) {
+          // not mapped, get next cluster from FAT
+          if (!vol_->fatGet(curCluster_, &next)) goto fail;
+        }
         if (vol_->isEOC(next)) {
           // add cluster if at end of chain
           if (!addCluster()) goto fail;
@@ -202,6 +202,10 @@ class SdBaseFile {
    */
   void setpos(sd_fpos_t* pos);
   //----------------------------------------------------------------------------
+  /** Allocate clusters in contiguous runs while writing, see
+   * ALLOC_AHEAD_CLUSTERS.  For a file that is written sequentially.
+   */
+  void allocAhead() {flags_ |= F_FILE_ALLOC_AHEAD;}
   bool close();
   bool contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
   bool createContiguous(SdBaseFile* dirFile,
@@ -245,7 +249,11 @@ class SdBaseFile {
   }
   /**  Cancel the date/time callback function. */
   static void dateTimeCallbackCancel() {dateTime_ = 0;}
+  /** \return Block number of the file's directory entry. */
+  uint32_t dirBlock() const {return dirBlock_;}
   bool dirEntry(dir_t* dir);
+  /** \return Index of the file's directory entry in dirBlock(). */
+  uint8_t dirIndex() const {return dirIndex_;}
   static void dirName(const dir_t& dir, char* name);
   bool exists(const char* name);
   int16_t fgets(char* str, int16_t num, char* delim = 0);
@@ -267,6 +275,7 @@ class SdBaseFile {
     return type_ == FAT_FILE_TYPE_ROOT_FIXED || type_ == FAT_FILE_TYPE_ROOT32;
   }
   void ls( uint8_t flags = 0, uint8_t indent = 0);
+  bool mapExtents();
   bool mkdir(SdBaseFile* dir, const char* path, bool pFlag = true);
   // alias for backward compactability
   bool makeDir(SdBaseFile* dir, const char* path) {
@@ -275,14 +284,23 @@ class SdBaseFile {
   bool open(SdBaseFile* dirFile, uint16_t index, uint8_t oflag);
   bool open(SdBaseFile* dirFile, const char* path, uint8_t oflag);
   bool open(const char* path, uint8_t oflag = O_READ);
+  bool openEntry(SdVolume* vol, uint32_t block, uint8_t index, uint8_t oflag);
   bool openNext(SdBaseFile* dirFile, uint8_t oflag);
   bool openRoot(SdVolume* vol);
   int peek();
+#if USE_BLOCK_PREFETCH
+  void prefetch();
+#endif  // USE_BLOCK_PREFETCH
   static void printFatDate(uint16_t fatDate);
   static void printFatTime( uint16_t fatTime);
   bool printName();
   int16_t read();
   int16_t read(void* buf, uint16_t nbyte);
+  int16_t readCached(const uint8_t** data);
+  bool readCachedValid();
+#if USE_MULTI_BLOCK_READ
+  int16_t readStreamed(uint8_t* buf, uint16_t nbyte);
+#endif  // USE_MULTI_BLOCK_READ
   int8_t readDir(dir_t* dir, char* longFilename);
   static bool remove(SdBaseFile* dirFile, const char* path);
   bool remove();
@@ -331,6 +349,8 @@ class SdBaseFile {
   // bits defined in flags_
   // should be 0X0F
   static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
+  // clusters are allocated ALLOC_AHEAD_CLUSTERS at a time
+  static uint8_t const F_FILE_ALLOC_AHEAD = 0X10;
   // sync of directory entry required
   static uint8_t const F_FILE_DIR_DIRTY = 0X80;
 
@@ -351,6 +371,7 @@ class SdBaseFile {
   // private functions
   bool addCluster();
   bool addDirCluster();
+  bool curBlock(uint32_t* block);
   dir_t* cacheDirEntry(uint8_t action);
   int8_t lsPrintNext( uint8_t flags, uint8_t indent);
   static bool make83Name(const char* str, uint8_t* name, const char** ptr);
@@ -67,6 +67,50 @@
  */
 #define FAT12_SUPPORT 0
 //------------------------------------------------------------------------------
+/**
+ * Use multiple block reads (CMD18) for the sequential reads done by
+ * SdBaseFile::readCached() if USE_MULTI_BLOCK_READ is nonzero.  The open
+ * sequence is stopped with CMD12 before any other card access and single
+ * block reads (CMD17) are used after a seek or a read error.
+ */
+#define USE_MULTI_BLOCK_READ 1
+//------------------------------------------------------------------------------
+/**
+ * Read the next block of a file opened by SdBaseFile::readCached() into a
+ * second 512 byte buffer while the current block is being used, if
+ * USE_BLOCK_PREFETCH is nonzero.  SdBaseFile::prefetch() transfers at most
+ * BLOCK_PREFETCH_CHUNK bytes per call.  Requires USE_MULTI_BLOCK_READ.
+ * Enabled by SD_BLOCK_PREFETCH in Configuration_adv.h.
+ */
+#ifdef SD_BLOCK_PREFETCH
+#define USE_BLOCK_PREFETCH 1
+#else  // SD_BLOCK_PREFETCH
+#define USE_BLOCK_PREFETCH 0
+#endif  // SD_BLOCK_PREFETCH
+#define BLOCK_PREFETCH_CHUNK 64
+#if USE_BLOCK_PREFETCH && !USE_MULTI_BLOCK_READ
+#error USE_BLOCK_PREFETCH requires USE_MULTI_BLOCK_READ
+#endif
+#if defined(SD_PREHEAT_LOOKAHEAD) && !USE_MULTI_BLOCK_READ
+#error SD_PREHEAT_LOOKAHEAD requires USE_MULTI_BLOCK_READ
+#endif
+//------------------------------------------------------------------------------
+/**
+ * Number of runs of consecutive clusters SdVolume keeps for the file mapped
+ * by SdBaseFile::mapExtents().  Reads and seeks inside the mapped runs do
+ * not need FAT reads.  A contiguous file is a single run.  Set to zero to
+ * disable.  Each run uses 12 bytes of RAM.
+ */
+#define FAT_EXTENT_COUNT 8
+//------------------------------------------------------------------------------
+/**
+ * Clusters allocated at once by a file after SdBaseFile::allocAhead().
+ * They are allocated as one contiguous run and mapped as an extent, so
+ * writing them needs no FAT reads or writes.  Clusters that are not used
+ * are freed when the file is closed.
+ */
+#define ALLOC_AHEAD_CLUSTERS 64
+//------------------------------------------------------------------------------
 /**
  * SPI init rate for SD initialization commands. Must be 5 (F_CPU/64)
  * or 6 (F_CPU/128).
@@ -29,6 +29,11 @@ cache_t  SdVolume::cacheBuffer_;       // 512 byte cache for Sd2Card
 Sd2Card* SdVolume::sdCard_;            // pointer to SD card object
 bool     SdVolume::cacheDirty_;        // cacheFlush() will write block if true
 uint32_t SdVolume::cacheMirrorBlock_;  // mirror  block for second FAT
+#if USE_BLOCK_PREFETCH
+cache_t  SdVolume::prefetchBuffer_;       // read ahead buffer for Sd2Card
+uint32_t SdVolume::prefetchBlockNumber_;  // block number for read ahead
+bool     SdVolume::prefetchReady_;        // read ahead is complete
+#endif  // USE_BLOCK_PREFETCH
 #endif  // USE_MULTIPLE_CARDS
 //------------------------------------------------------------------------------
 // find a contiguous group of clusters
@@ -106,6 +111,9 @@ bool SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
 //------------------------------------------------------------------------------
 bool SdVolume::cacheFlush() {
   if (cacheDirty_) {
+#if USE_BLOCK_PREFETCH
+    cachePrefetchClear();
+#endif  // USE_BLOCK_PREFETCH
     if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
       goto fail;
     }
@@ -138,6 +146,63 @@ bool SdVolume::cacheRawBlock(uint32_t blockNumber, bool dirty) {
   return false;
 }
 //------------------------------------------------------------------------------
+#if USE_MULTI_BLOCK_READ
+// read a block into the cache as part of a multiple block read sequence
+bool SdVolume::cacheStreamBlock(uint32_t blockNumber) {
+  if (cacheBlockNumber_ != blockNumber) {
+    if (!cacheFlush()) goto fail;
+#if USE_BLOCK_PREFETCH
+    if (prefetchBlockNumber_ == blockNumber) {
+      prefetchBlockNumber_ = 0XFFFFFFFF;
+      // finishes a partly read block, or reads it again after an error
+      if (!prefetchReady_
+        && !sdCard_->readBlockStream(blockNumber, prefetchBuffer_.data)) {
+        goto fail;
+      }
+      memcpy(cacheBuffer_.data, prefetchBuffer_.data, 512);
+      cacheBlockNumber_ = blockNumber;
+      return true;
+    }
+#endif  // USE_BLOCK_PREFETCH
+    if (!sdCard_->readBlockStream(blockNumber, cacheBuffer_.data)) goto fail;
+    cacheBlockNumber_ = blockNumber;
+  }
+  return true;
+
+ fail:
+  cacheBlockNumber_ = 0XFFFFFFFF;
+  return false;
+}
+#endif  // USE_MULTI_BLOCK_READ
+#if USE_BLOCK_PREFETCH
+//------------------------------------------------------------------------------
+// Read part of a block into the prefetch buffer.  Only the block the open
+// multiple block read is positioned at is read, so no command is needed.
+void SdVolume::cachePrefetch(uint32_t blockNumber) {
+  int8_t rtn;
+  if (cacheBlockNumber_ == blockNumber) return;
+  if (prefetchBlockNumber_ == blockNumber && prefetchReady_) return;
+  if (sdCard_->streamBlock() != blockNumber) {
+    // a partly read block must not be completed into another buffer
+    if (prefetchBlockNumber_ != 0XFFFFFFFF && !prefetchReady_) {
+      sdCard_->readStreamEnd();
+    }
+    prefetchBlockNumber_ = 0XFFFFFFFF;
+    return;
+  }
+  if (prefetchBlockNumber_ != blockNumber) {
+    prefetchBlockNumber_ = blockNumber;
+    prefetchReady_ = false;
+  }
+  rtn = sdCard_->readStreamPart(prefetchBuffer_.data, BLOCK_PREFETCH_CHUNK);
+  if (rtn < 0) {
+    prefetchBlockNumber_ = 0XFFFFFFFF;
+  } else if (rtn > 0) {
+    prefetchReady_ = true;
+  }
+}
+#endif  // USE_BLOCK_PREFETCH
+//------------------------------------------------------------------------------
 // return the size in bytes of a cluster chain
 bool SdVolume::chainSize(uint32_t cluster, uint32_t* size) {
   uint32_t s = 0;
@@ -152,6 +217,67 @@ bool SdVolume::chainSize(uint32_t cluster, uint32_t* size) {
   return false;
 }
 //------------------------------------------------------------------------------
+// Advance cluster by count clusters using the runs of the mapped chain.
+// Returns the number of clusters left to follow with fatGet(), this is
+// count if firstCluster is not the mapped chain.
+uint32_t SdVolume::extentAdvance(uint32_t firstCluster, uint32_t* cluster,
+  uint32_t count) {
+#if FAT_EXTENT_COUNT
+  uint32_t c = *cluster;
+  uint32_t left;
+  uint8_t i = 0;
+
+  if (!extentFile_ || firstCluster != extentFile_) return count;
+  // find the run holding cluster, runs are in chain order
+  while (c < extent_[i].first || c > extent_[i].last) {
+    if (++i >= extentCount_) return count;
+  }
+  for (; i < extentCount_; i++) {
+    left = extent_[i].last - c;
+    if (count <= left) {
+      *cluster = c + count;
+      return 0;
+    }
+    count -= left + 1;
+    c = extent_[i].next;
+  }
+  // past the mapped runs
+  *cluster = c;
+#endif  // FAT_EXTENT_COUNT
+  return count;
+}
+//------------------------------------------------------------------------------
+// Record the runs of consecutive clusters of a chain, up to FAT_EXTENT_COUNT.
+bool SdVolume::extentMap(uint32_t firstCluster) {
+#if FAT_EXTENT_COUNT
+  uint32_t cluster = firstCluster;
+  uint32_t next;
+
+  extentFile_ = 0;
+  extentCount_ = 0;
+  if (cluster < 2) return true;
+  extent_[0].first = cluster;
+  while (1) {
+    if (!fatGet(cluster, &next)) goto fail;
+    if (next != cluster + 1) {
+      extent_[extentCount_].last = cluster;
+      extent_[extentCount_].next = next;
+      extentCount_++;
+      if (isEOC(next) || extentCount_ == FAT_EXTENT_COUNT) break;
+      extent_[extentCount_].first = next;
+    }
+    cluster = next;
+  }
+  extentFile_ = firstCluster;
+  return true;
+
+ fail:
+  return false;
+#else  // FAT_EXTENT_COUNT
+  return true;
+#endif  // FAT_EXTENT_COUNT
+}
+//------------------------------------------------------------------------------
 // Fetch a FAT entry
 bool SdVolume::fatGet(uint32_t cluster, uint32_t* value) {
   uint32_t lba;
@@ -196,6 +322,10 @@ bool SdVolume::fatGet(uint32_t cluster, uint32_t* value) {
 // Store a FAT entry
 bool SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   uint32_t lba;
+#if FAT_EXTENT_COUNT
+  // the mapped chain may change
+  extentFile_ = 0;
+#endif  // FAT_EXTENT_COUNT
   // error if reserved cluster
   if (cluster < 2) goto fail;
 
@@ -333,6 +463,12 @@ bool SdVolume::init(Sd2Card* dev, uint8_t part) {
   cacheDirty_ = 0;  // cacheFlush() will write block if true
   cacheMirrorBlock_ = 0;
   cacheBlockNumber_ = 0XFFFFFFFF;
+#if USE_BLOCK_PREFETCH
+  cachePrefetchClear();
+#endif  // USE_BLOCK_PREFETCH
+#if FAT_EXTENT_COUNT
+  extentFile_ = 0;
+#endif  // FAT_EXTENT_COUNT
 
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
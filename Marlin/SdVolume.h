@@ -53,6 +53,18 @@ union cache_t {
   fat32_fsinfo_t fsinfo;
 };
 //------------------------------------------------------------------------------
+/**
+ * \brief Run of consecutive clusters in a cluster chain
+ */
+struct fat_extent_t {
+           /** First cluster of the run. */
+  uint32_t first;
+           /** Last cluster of the run. */
+  uint32_t last;
+           /** FAT entry of the last cluster, next run or EOC. */
+  uint32_t next;
+};
+//------------------------------------------------------------------------------
 /**
  * \class SdVolume
  * \brief Access FAT16 and FAT32 volumes on SD and SDHC cards.
@@ -60,7 +72,11 @@ union cache_t {
 class SdVolume {
  public:
   /** Create an instance of SdVolume */
-  SdVolume() : fatType_(0) {}
+  SdVolume() : fatType_(0) {
+#if FAT_EXTENT_COUNT
+    extentFile_ = 0;
+#endif  // FAT_EXTENT_COUNT
+  }
   /** Clear the cache and returns a pointer to the cache.  Used by the WaveRP
    * recorder to do raw write to the SD card.  Not for normal apps.
    * \return A pointer to the cache buffer or zero if an error occurs.
@@ -133,12 +149,22 @@ class SdVolume {
   Sd2Card* sdCard_;            // Sd2Card object for cache
   bool cacheDirty_;            // cacheFlush() will write block if true
   uint32_t cacheMirrorBlock_;  // block number for mirror FAT
+#if USE_BLOCK_PREFETCH
+  cache_t prefetchBuffer_;        // next block of the file being read
+  uint32_t prefetchBlockNumber_;  // block in or going into prefetchBuffer_
+  bool prefetchReady_;            // prefetchBuffer_ holds all of the block
+#endif  // USE_BLOCK_PREFETCH
 #else  // USE_MULTIPLE_CARDS
   static cache_t cacheBuffer_;        // 512 byte cache for device blocks
   static uint32_t cacheBlockNumber_;  // Logical number of block in the cache
   static Sd2Card* sdCard_;            // Sd2Card object for cache
   static bool cacheDirty_;            // cacheFlush() will write block if true
   static uint32_t cacheMirrorBlock_;  // block number for mirror FAT
+#if USE_BLOCK_PREFETCH
+  static cache_t prefetchBuffer_;        // next block of the file being read
+  static uint32_t prefetchBlockNumber_;  // block in or going into prefetchBuffer_
+  static bool prefetchReady_;            // prefetchBuffer_ holds all of the block
+#endif  // USE_BLOCK_PREFETCH
 #endif  // USE_MULTIPLE_CARDS
   uint32_t allocSearchStart_;   // start cluster for alloc search
   uint8_t blocksPerCluster_;    // cluster size in blocks
@@ -151,6 +177,11 @@ class SdVolume {
   uint8_t fatType_;             // volume type (12, 16, OR 32)
   uint16_t rootDirEntryCount_;  // number of entries in FAT16 root dir
   uint32_t rootDirStart_;       // root start block for FAT16, cluster for FAT32
+#if FAT_EXTENT_COUNT
+  uint32_t extentFile_;         // first cluster of mapped chain, zero if none
+  uint8_t extentCount_;         // runs in extent_
+  fat_extent_t extent_[FAT_EXTENT_COUNT];  // runs of the mapped chain
+#endif  // FAT_EXTENT_COUNT
   //----------------------------------------------------------------------------
   bool allocContiguous(uint32_t count, uint32_t* curCluster);
   uint8_t blockOfCluster(uint32_t position) const {
@@ -168,6 +199,22 @@ class SdVolume {
   static bool cacheFlush();
   static bool cacheRawBlock(uint32_t blockNumber, bool dirty);
 #endif  // USE_MULTIPLE_CARDS
+#if USE_MULTI_BLOCK_READ
+#if USE_MULTIPLE_CARDS
+  bool cacheStreamBlock(uint32_t blockNumber);
+#else  // USE_MULTIPLE_CARDS
+  static bool cacheStreamBlock(uint32_t blockNumber);
+#endif  // USE_MULTIPLE_CARDS
+#endif  // USE_MULTI_BLOCK_READ
+#if USE_BLOCK_PREFETCH
+#if USE_MULTIPLE_CARDS
+  void cachePrefetch(uint32_t blockNumber);
+  void cachePrefetchClear() {prefetchBlockNumber_ = 0XFFFFFFFF;}
+#else  // USE_MULTIPLE_CARDS
+  static void cachePrefetch(uint32_t blockNumber);
+  static void cachePrefetchClear() {prefetchBlockNumber_ = 0XFFFFFFFF;}
+#endif  // USE_MULTIPLE_CARDS
+#endif  // USE_BLOCK_PREFETCH
   // used by SdBaseFile write to assign cache to SD location
   void cacheSetBlockNumber(uint32_t blockNumber, bool dirty) {
     cacheDirty_ = dirty;
@@ -175,6 +222,9 @@ class SdVolume {
   }
   void cacheSetDirty() {cacheDirty_ |= CACHE_FOR_WRITE;}
   bool chainSize(uint32_t beginCluster, uint32_t* size);
+  uint32_t extentAdvance(uint32_t firstCluster, uint32_t* cluster,
+    uint32_t count);
+  bool extentMap(uint32_t firstCluster);
   bool fatGet(uint32_t cluster, uint32_t* value);
   bool fatPut(uint32_t cluster, uint32_t value);
   bool fatPutEOC(uint32_t cluster) {
@@ -189,6 +239,9 @@ class SdVolume {
   bool readBlock(uint32_t block, uint8_t* dst) {
     return sdCard_->readBlock(block, dst);}
   bool writeBlock(uint32_t block, const uint8_t* dst) {
+#if USE_BLOCK_PREFETCH
+    cachePrefetchClear();
+#endif  // USE_BLOCK_PREFETCH
     return sdCard_->writeBlock(block, dst);
   }
 //------------------------------------------------------------------------------
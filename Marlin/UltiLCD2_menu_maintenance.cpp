@@ -8,6 +8,7 @@
 #include "UltiLCD2_menu_material.h"
 #include "cardreader.h"
 #include "lifetime_stats.h"
+#include "temp_log.h"
 #include "ConfigurationStore.h"
 #include "temperature.h"
 #include "pins.h"
@@ -21,6 +22,12 @@ static void lcd_menu_advanced_version();
 static void lcd_menu_advanced_stats();
 static void lcd_menu_maintenance_motion();
 static void lcd_menu_advanced_factory_reset();
+#ifdef TEMP_LOG
+static void lcd_menu_advanced_temperature_graph();
+#define TEMP_LOG_MENU_OFFSET 1
+#else
+#define TEMP_LOG_MENU_OFFSET 0
+#endif
 
 void lcd_menu_maintenance()
 {
@@ -81,7 +88,11 @@ static char* lcd_advanced_item(uint8_t nr)
         strcpy_P(card.longFilename, PSTR("Version"));
     else if (nr == 9 + BED_MENU_OFFSET + EXTRUDERS * 2)
         strcpy_P(card.longFilename, PSTR("Runtime stats"));
+#ifdef TEMP_LOG
     else if (nr == 10 + BED_MENU_OFFSET + EXTRUDERS * 2)
+        strcpy_P(card.longFilename, PSTR("Temperature graph"));
+#endif
+    else if (nr == 10 + TEMP_LOG_MENU_OFFSET + BED_MENU_OFFSET + EXTRUDERS * 2)
         strcpy_P(card.longFilename, PSTR("Factory reset"));
     else
         strcpy_P(card.longFilename, PSTR("???"));
@@ -133,7 +144,7 @@ static void lcd_menu_maintenance_advanced_return()
 
 static void lcd_menu_maintenance_advanced()
 {
-    lcd_scroll_menu(PSTR("ADVANCED"), 11 + BED_MENU_OFFSET + EXTRUDERS * 2, lcd_advanced_item, lcd_advanced_details);
+    lcd_scroll_menu(PSTR("ADVANCED"), 11 + TEMP_LOG_MENU_OFFSET + BED_MENU_OFFSET + EXTRUDERS * 2, lcd_advanced_item, lcd_advanced_details);
     if (lcd_lib_button_pressed)
     {
         if (IS_SELECTED_SCROLL(0))
@@ -208,7 +219,11 @@ static void lcd_menu_maintenance_advanced()
             lcd_change_to_menu(lcd_menu_advanced_version, SCROLL_MENU_ITEM_POS(0));
         else if (IS_SELECTED_SCROLL(9 + BED_MENU_OFFSET + EXTRUDERS * 2))
             lcd_change_to_menu(lcd_menu_advanced_stats, SCROLL_MENU_ITEM_POS(0));
+#ifdef TEMP_LOG
         else if (IS_SELECTED_SCROLL(10 + BED_MENU_OFFSET + EXTRUDERS * 2))
+            lcd_change_to_menu(lcd_menu_advanced_temperature_graph, SCROLL_MENU_ITEM_POS(0));
+#endif
+        else if (IS_SELECTED_SCROLL(10 + TEMP_LOG_MENU_OFFSET + BED_MENU_OFFSET + EXTRUDERS * 2))
             lcd_change_to_menu(lcd_menu_advanced_factory_reset, SCROLL_MENU_ITEM_POS(1));
     }
 }
@@ -323,6 +338,60 @@ void lcd_menu_advanced_stats()
     lcd_lib_update_screen();
 }
 
+#ifdef TEMP_LOG
+#define GRAPH_LEFT 3
+#define GRAPH_RIGHT 124
+#define GRAPH_TOP 9
+#define GRAPH_BOTTOM 46
+#define GRAPH_MAX_TEMPERATURE 3000 //Tenths of a degree at the top of the graph.
+
+static uint8_t lcd_graph_y(int16_t temperature)
+{
+    if (temperature < 0)
+        temperature = 0;
+    if (temperature > GRAPH_MAX_TEMPERATURE)
+        temperature = GRAPH_MAX_TEMPERATURE;
+    return GRAPH_BOTTOM - long(temperature) * (GRAPH_BOTTOM - GRAPH_TOP) / GRAPH_MAX_TEMPERATURE;
+}
+
+//The temperature log with the nozzles as lines and the buildplate as dots, the newest sample at the right.
+static void lcd_menu_advanced_temperature_graph()
+{
+    lcd_info_screen(previousMenu, NULL, PSTR("Return"));
+    char buffer[LCD_MAX_TEXT_LINE_LENGTH + 1];
+    char* c = buffer;
+    for(uint8_t e=0; e<EXTRUDERS; e++)
+        c = int_to_string(int(dsp_temperature[e]), c, PSTR("C "));
+#if TEMP_SENSOR_BED != 0
+    c = int_to_string(int(dsp_temperature_bed), c, PSTR("C"));
+#endif
+    lcd_lib_draw_string(GRAPH_LEFT, 0, buffer);
+
+    uint8_t count = temp_log_count();
+    if (count > (GRAPH_RIGHT - GRAPH_LEFT) / 2)
+        count = (GRAPH_RIGHT - GRAPH_LEFT) / 2;
+    for(uint8_t age=0; age<count; age++)
+    {
+        const temp_log_sample_t* sample = temp_log_sample(age);
+        uint8_t x = GRAPH_RIGHT - age * 2;
+#if TEMP_SENSOR_BED != 0
+        uint8_t y = lcd_graph_y(sample->temperature_bed);
+        lcd_lib_draw_hline(x, x, y);
+#endif
+        for(uint8_t e=0; e<EXTRUDERS; e++)
+        {
+            uint8_t y0 = lcd_graph_y(sample->temperature[e]);
+            uint8_t y1 = y0;
+            if (age + 1 < count)
+                y1 = lcd_graph_y(temp_log_sample(age + 1)->temperature[e]);
+            lcd_lib_draw_vline(x - 1, min(y0, y1), max(y0, y1));
+            lcd_lib_draw_hline(x - 1, x, y0);
+        }
+    }
+    lcd_lib_update_screen();
+}
+#endif//TEMP_LOG
+
 static void doFactoryReset()
 {
     //Clear the EEPROM settings so they get read from default.
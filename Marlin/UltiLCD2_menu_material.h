@@ -9,6 +9,8 @@ Settings:          0x0064-0x00E0 0x7C? (careful with this one)
 ChangeMatSettings: 0x0410-0x0334 (18*2)=0x24
 ChangeMatSettings: 0x0440-0x0352 (18)=0x12
 FirstRunDone:      0x0400-0x0400 0x01
+SdSortMode:        0x0401-0x0401 0x01
+PowerResume:       0x0480-0x06C0 0x10+(16*35)=0x240 Header and the ring of checkpoint slots, see power_resume.cpp.
 RuntimeStats:      0x0700-0x071C 0x1C
 Materials:         0x0800-0x09B1 (8+16)*18+1=0x1B1
 ExtraTemperatures: 0x0a00-0x0C40 (16*18*2)=0x240
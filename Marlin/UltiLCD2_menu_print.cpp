@@ -250,45 +250,14 @@ void lcd_sd_menu_details_callback(uint8_t nr)
                         return;
                     }
                     LCD_DETAIL_CACHE_ID() = nr;
-                    LCD_DETAIL_CACHE_TIME() = 0;
+                    gcode_meta_t meta;
+                    card.getfilemeta(&meta);
+                    LCD_DETAIL_CACHE_TIME() = meta.time;
                     for(uint8_t e=0; e<EXTRUDERS; e++)
                     {
-                        LCD_DETAIL_CACHE_MATERIAL(e) = 0;
-                        LCD_DETAIL_CACHE_NOZZLE_DIAMETER(e) = 0.4;
-                        LCD_DETAIL_CACHE_MATERIAL_TYPE(e)[0] = '\0';
-                    }
-                    card.openFile(card.filename, true);
-                    if (card.isFileOpen())
-                    {
-                        for(uint8_t n=0;n<16;n++)
-                        {
-                            card.fgets(buffer, sizeof(buffer));
-                            buffer[sizeof(buffer)-1] = '\0';
-                            while (strlen(buffer) > 0 && buffer[strlen(buffer)-1] < ' ') buffer[strlen(buffer)-1] = '\0';
-                            if (strncmp_P(buffer, PSTR(";TIME:"), 6) == 0)
-                                LCD_DETAIL_CACHE_TIME() = atol(buffer + 6);
-                            else if (strncmp_P(buffer, PSTR(";MATERIAL:"), 10) == 0)
-                                LCD_DETAIL_CACHE_MATERIAL(0) = atol(buffer + 10);
-                            else if (strncmp_P(buffer, PSTR(";NOZZLE_DIAMETER:"), 17) == 0)
-                                LCD_DETAIL_CACHE_NOZZLE_DIAMETER(0) = strtod(buffer + 17, NULL);
-                            else if (strncmp_P(buffer, PSTR(";MTYPE:"), 7) == 0)
-                            {
-                                strncpy(LCD_DETAIL_CACHE_MATERIAL_TYPE(0), buffer + 7, 8);
-                                LCD_DETAIL_CACHE_MATERIAL_TYPE(0)[7] = '\0';
-                            }
-#if EXTRUDERS > 1
-                            else if (strncmp_P(buffer, PSTR(";MATERIAL2:"), 11) == 0)
-                                LCD_DETAIL_CACHE_MATERIAL(1) = atol(buffer + 11);
-                            else if (strncmp_P(buffer, PSTR(";NOZZLE_DIAMETER2:"), 18) == 0)
-                                LCD_DETAIL_CACHE_NOZZLE_DIAMETER(1) = strtod(buffer + 18, NULL);
-                            else if (strncmp_P(buffer, PSTR(";MTYPE2:"), 8) == 0)
-                            {
-                                strncpy(LCD_DETAIL_CACHE_MATERIAL_TYPE(1), buffer + 8, 8);
-                                LCD_DETAIL_CACHE_MATERIAL_TYPE(1)[7] = '\0';
-                            }
-#endif
-                            
-                        }
+                        LCD_DETAIL_CACHE_MATERIAL(e) = meta.material[e];
+                        LCD_DETAIL_CACHE_NOZZLE_DIAMETER(e) = meta.nozzle_diameter[e];
+                        strcpy(LCD_DETAIL_CACHE_MATERIAL_TYPE(e), meta.material_type[e]);
                     }
                     if (card.errorCode())
                     {
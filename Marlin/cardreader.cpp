@@ -1,3 +1,4 @@
+#include <avr/eeprom.h>
 #include "Marlin.h"
 #include "cardreader.h"
 #include "UltiLCD2.h"
@@ -5,15 +6,47 @@
 #include "stepper.h"
 #include "temperature.h"
 #include "language.h"
+#include "planner.h"
 
 #ifdef SDSUPPORT
 
+#ifdef SD_GCODE_META_INDEX
+#define META_INDEX_FILENAME "_GCMETA.IDX"
+#define META_INDEX_MAGIC 0x4D47
+#define META_SCAN_DONE 0xFFFFFFFF
+//Minimal time between two files added to the meta index in the background.
+#define META_SCAN_INTERVAL 100
+//Slots tried for a directory entry before the first one is overwritten.
+#define META_INDEX_PROBES 4
+
+struct gcode_meta_record_t
+{
+  uint16_t magic;
+  gcode_meta_key_t key;
+  gcode_meta_t meta;
+};
+#endif
+
+#ifdef SD_SORT
+#define SORT_FILENAME "_GCSORT.IDX"
+#define SORT_MAGIC 0x5347
+//Free byte after the first run flag.
+#define SORT_MODE_EEPROM_OFFSET 0x401
+
+struct sd_sort_entry_t
+{
+  char key[12];
+  uint16_t entry;
+};
+#endif
+
 
 
 CardReader::CardReader()
 {
    filesize = 0;
    sdpos = 0;
+   readLeft = 0;
    sdprinting = false;
    pause = false;
    cardOK = false;
@@ -22,6 +55,19 @@ CardReader::CardReader()
    autostart_atmillis=0;
    workDirDepth = 0;
    memset(workDirParents, 0, sizeof(workDirParents));
+   workDirChanged();
+#ifdef SD_GCODE_META_INDEX
+   metaIndexFailed = false;
+#endif
+#ifdef SD_PREHEAT_LOOKAHEAD
+   lookaheadActive = false;
+   lookaheadResync = false;
+#endif
+#ifdef SD_SORT
+   sortFailed = false;
+   sortMode = SD_SORT_DEFAULT_MODE;
+   sortValid = false;
+#endif
 
    autostart_stilltocheck=true; //the sd start is delayed, because otherwise the serial cannot answer fast enought to make contact with the hostsoftware.
    lastnr=0;
@@ -50,14 +96,34 @@ char *createFilename(char *buffer,const dir_t &p) //buffer>12characters
   return buffer;
 }
 
+//Files and folders that are shown in listings, G-code files only and no hidden names.
+static bool lsListed(const dir_t &p, const char* longFilename)
+{
+  if (p.name[0] == DIR_NAME_DELETED || p.name[0] == '.'|| p.name[0] == '_') return false;
+  if (longFilename[0] != '\0' &&
+      (longFilename[0] == '.' || longFilename[0] == '_')) return false;
+  if (!DIR_IS_FILE_OR_SUBDIR(&p)) return false;
+  if (!DIR_IS_SUBDIR(&p))
+  {
+    if(p.name[8]!='G') return false;
+    if(p.name[9]=='~') return false;
+  }
+  return true;
+}
+
 
 void  CardReader::lsDive(const char *prepend,SdFile parent)
 {
   dir_t p;
  uint8_t cnt=0;
 
-  while (parent.readDir(p, longFilename) > 0)
+  while (true)
   {
+#if SD_DIR_INDEX_SIZE > 0
+    uint16_t dirEntry = parent.curPosition() >> 5;
+#endif
+    if (parent.readDir(p, longFilename) <= 0)
+      break;
     if( DIR_IS_SUBDIR(&p) && lsAction!=LS_Count && lsAction!=LS_GetFilename) // hence LS_SerialPrint
     {
 
@@ -94,24 +160,9 @@ void  CardReader::lsDive(const char *prepend,SdFile parent)
     else
     {
       if (p.name[0] == DIR_NAME_FREE) break;
-      if (p.name[0] == DIR_NAME_DELETED || p.name[0] == '.'|| p.name[0] == '_') continue;
-      if (longFilename[0] != '\0' &&
-          (longFilename[0] == '.' || longFilename[0] == '_')) continue;
-      if ( p.name[0] == '.')
-      {
-        if ( p.name[1] != '.')
-        continue;
-      }
-
-      if (!DIR_IS_FILE_OR_SUBDIR(&p)) continue;
+      if (!lsListed(p, longFilename)) continue;
       filenameIsDir=DIR_IS_SUBDIR(&p);
 
-
-      if(!filenameIsDir)
-      {
-        if(p.name[8]!='G') continue;
-        if(p.name[9]=='~') continue;
-      }
       //if(cnt++!=nr) continue;
       createFilename(filename,p);
       if(lsAction==LS_SerialPrint)
@@ -121,12 +172,21 @@ void  CardReader::lsDive(const char *prepend,SdFile parent)
       }
       else if(lsAction==LS_Count)
       {
+#if SD_DIR_INDEX_SIZE > 0
+        dirIndexAdd(dirEntry);
+#endif
         nrFiles++;
       }
       else if(lsAction==LS_GetFilename)
       {
         if(cnt==nrFiles)
+        {
+          filenameKey.dirEntry = (parent.curPosition() >> 5) - 1;
+          filenameKey.size = p.fileSize;
+          filenameKey.date = p.lastWriteDate;
+          filenameKey.time = p.lastWriteTime;
           return;
+        }
         cnt++;
 
       }
@@ -140,6 +200,15 @@ void CardReader::ls()
   if(lsAction==LS_Count)
   nrFiles=0;
 
+#ifdef SD_SORT
+  if (sortMode != SD_SORT_NONE)
+  {
+    lsSorted("",root);
+    //The order of the last listed folder is left in the sort file.
+    sortValid = false;
+    return;
+  }
+#endif
   root.rewind();
   lsDive("",root);
 }
@@ -150,6 +219,19 @@ void CardReader::initsd()
   cardOK = false;
   if(root.isOpen())
     root.close();
+#ifdef SD_GCODE_META_INDEX
+  if(metaFile.isOpen())
+    metaFile.close();
+  metaIndexFailed = false;
+#endif
+#ifdef SD_SORT
+  if(sortFile.isOpen())
+    sortFile.close();
+  sortFailed = false;
+  sortMode = eeprom_read_byte((const uint8_t*)SORT_MODE_EEPROM_OFFSET);
+  if (sortMode > SD_SORT_BY_DATE)
+    sortMode = SD_SORT_DEFAULT_MODE;
+#endif
 #ifdef SDSLOW
   if (!card.init(SPI_HALF_SPEED,SDSS))
 #else
@@ -178,6 +260,7 @@ void CardReader::initsd()
   }
   workDir=root;
   curDir=&root;
+  workDirChanged();
   /*
   if(!workDir.openRoot(&volume))
   {
@@ -194,6 +277,7 @@ void CardReader::setroot()
     SERIAL_ECHOLNPGM(MSG_SD_WORKDIR_FAIL);
   }*/
   workDir=root;
+  workDirChanged();
 
   curDir=&workDir;
 }
@@ -202,16 +286,46 @@ void CardReader::release()
   sdprinting = false;
   pause = false;
   cardOK = false;
+  workDirChanged();
 }
 
 void CardReader::startFileprint()
 {
   if(cardOK)
   {
+    //Follow the cluster chain once now, so printing does not need FAT reads.
+    file.mapExtents();
     sdprinting = true;
     pause = false;
+#ifdef SD_PREHEAT_LOOKAHEAD
+    lookaheadResync = true;
+#endif
+  }
+}
+
+#ifdef POWER_LOSS_RESUME
+//Open the file of an interrupted print by its directory entry and continue at pos, without starting to print.
+bool CardReader::resumeFile(uint32_t dirBlock, uint8_t dirIndex, uint32_t size, uint32_t pos)
+{
+  if(!cardOK)
+    return false;
+  file.close();
+  sdprinting = false;
+  pause = false;
+  readLeft = 0;
+  if (!file.openEntry(&volume, dirBlock, dirIndex, O_READ) || file.fileSize() != size || pos > size)
+  {
+    file.close();
+    clearError();
+    return false;
   }
+  filesize = size;
+  //The seek follows the cluster chain from the extents instead of reading the FAT.
+  file.mapExtents();
+  setIndex(pos);
+  return true;
 }
+#endif
 
 void CardReader::pauseSDPrint()
 {
@@ -235,6 +349,7 @@ void CardReader::openFile(const char* name,bool read)
   file.close();
   sdprinting = false;
   pause = false;
+  readLeft = 0;
 
 
   SdFile myDir;
@@ -308,6 +423,7 @@ void CardReader::openFile(const char* name,bool read)
   }
   else
   { //write
+    workDirChanged();
     if (!file.open(curDir, fname, O_CREAT | O_APPEND | O_WRITE | O_TRUNC))
     {
       SERIAL_PROTOCOLPGM(MSG_SD_OPEN_FILE_FAIL);
@@ -316,6 +432,9 @@ void CardReader::openFile(const char* name,bool read)
     }
     else
     {
+      //Uploads are written sequentially, allocate contiguous runs of clusters that need no FAT updates.
+      if (!logging)
+        file.allocAhead();
       saving = true;
       SERIAL_PROTOCOLPGM(MSG_SD_WRITE_TO_FILE);
       SERIAL_PROTOCOLLN(name);
@@ -332,6 +451,7 @@ void CardReader::removeFile(const char* name)
   file.close();
   sdprinting = false;
   pause = false;
+  workDirChanged();
 
 
   SdFile myDir;
@@ -414,6 +534,58 @@ void CardReader::getStatus()
     SERIAL_PROTOCOLLN(card.errorCode());
   }
 }
+//Read the next command from the file, straight from the block in the volume cache.
+//Comments are stripped while copying, and empty lines are skipped. A command ends at a line end or a ':',
+//or when the buffer is full. Returns the length of the command, 0 at the end of the file, or -1 on a read error.
+int16_t CardReader::getLine(char* str, int16_t size)
+{
+  int16_t count = 0;
+  bool comment = false;
+
+  //The cache could have been used for an other block since the last call (directory reads), in that case read the block again.
+  if (readLeft > 0 && !file.readCachedValid())
+  {
+    file.seekSet(file.curPosition() - readLeft);
+    readLeft = 0;
+  }
+  while(true)
+  {
+    if (readLeft == 0)
+    {
+      int16_t n = file.readCached(&readPtr);
+      if (n < 0)
+        return -1;
+      if (n == 0)
+        break;
+      readLeft = n;
+    }
+    while(readLeft > 0)
+    {
+      char c = *readPtr++;
+      readLeft--;
+      if (c == '\n' || c == '\r' || (c == ':' && !comment))
+      {
+        if (count > 0)
+          goto lineDone;
+        comment = false;
+        continue;
+      }
+      if (c == ';')
+        comment = true;
+      if (!comment)
+      {
+        str[count++] = c;
+        if (count >= size - 1)
+          goto lineDone;
+      }
+    }
+  }
+lineDone:
+  str[count] = '\0';
+  sdpos = file.curPosition() - readLeft;
+  return count;
+}
+
 void CardReader::write_command(char *buf)
 {
   char* begin = buf;
@@ -499,25 +671,654 @@ void CardReader::closefile()
 {
   file.sync();
   file.close();
+  card.readStreamEnd();
   saving = false;
   logging = false;
 }
 
-void CardReader::getfilename(const uint8_t nr)
+void CardReader::getfilename(const uint16_t nr)
 {
   curDir=&workDir;
   lsAction=LS_GetFilename;
   nrFiles=nr;
+#ifdef SD_SORT
+  if (sortMode != SD_SORT_NONE)
+  {
+    uint16_t entry;
+    if ((sortValid || sortOpen(workDir, true)) && sortRead(nr, &entry))
+    {
+      curDir->seekSet(uint32_t(entry) << 5);
+      nrFiles = 0;
+      lsDive("",*curDir);
+      return;
+    }
+  }
+#endif
+#if SD_DIR_INDEX_SIZE > 0
+  uint8_t n = nr >> dirIndexShift;
+  if (n < dirIndexCount)
+  {
+    //Start at the closest indexed file instead of at the start of the directory.
+    curDir->seekSet(uint32_t(dirIndex[n]) << 5);
+    nrFiles = nr - (n << dirIndexShift);
+    lsDive("",*curDir);
+    return;
+  }
+#endif
   curDir->rewind();
   lsDive("",*curDir);
 
 }
 
+#if SD_DIR_INDEX_SIZE > 0
+void CardReader::dirIndexAdd(uint16_t entry)
+{
+  //nrFiles is the number of this file, only every (1 << dirIndexShift)'th file is stored.
+  if (nrFiles & ((1 << dirIndexShift) - 1))
+    return;
+  if (dirIndexCount == SD_DIR_INDEX_SIZE)
+  {
+    //Index is full, keep every other position and double the distance between them.
+    for(uint8_t i=0; i<SD_DIR_INDEX_SIZE/2; i++)
+      dirIndex[i] = dirIndex[i*2];
+    dirIndexCount = SD_DIR_INDEX_SIZE/2;
+    dirIndexShift++;
+  }
+  dirIndex[dirIndexCount++] = entry;
+}
+#endif
+
+//Read the header comments of a G-code file, values that are not found keep their defaults.
+static void readMetaHeader(SdFile& f, gcode_meta_t* meta)
+{
+  char buffer[64];
+  for(uint8_t n=0;n<16;n++)
+  {
+    if (f.fgets(buffer, sizeof(buffer)) <= 0)
+      break;
+    buffer[sizeof(buffer)-1] = '\0';
+    while (strlen(buffer) > 0 && buffer[strlen(buffer)-1] < ' ') buffer[strlen(buffer)-1] = '\0';
+    if (strncmp_P(buffer, PSTR(";TIME:"), 6) == 0)
+      meta->time = atol(buffer + 6);
+    else if (strncmp_P(buffer, PSTR(";MATERIAL:"), 10) == 0)
+      meta->material[0] = atol(buffer + 10);
+    else if (strncmp_P(buffer, PSTR(";NOZZLE_DIAMETER:"), 17) == 0)
+      meta->nozzle_diameter[0] = strtod(buffer + 17, NULL);
+    else if (strncmp_P(buffer, PSTR(";MTYPE:"), 7) == 0)
+    {
+      strncpy(meta->material_type[0], buffer + 7, 8);
+      meta->material_type[0][7] = '\0';
+    }
+#if EXTRUDERS > 1
+    else if (strncmp_P(buffer, PSTR(";MATERIAL2:"), 11) == 0)
+      meta->material[1] = atol(buffer + 11);
+    else if (strncmp_P(buffer, PSTR(";NOZZLE_DIAMETER2:"), 18) == 0)
+      meta->nozzle_diameter[1] = strtod(buffer + 18, NULL);
+    else if (strncmp_P(buffer, PSTR(";MTYPE2:"), 8) == 0)
+    {
+      strncpy(meta->material_type[1], buffer + 8, 8);
+      meta->material_type[1][7] = '\0';
+    }
+#endif
+  }
+}
+
+bool CardReader::readMeta(uint16_t dirEntry, gcode_meta_t* meta)
+{
+  SdFile dir = workDir;
+  SdFile f;
+  meta->time = 0;
+  for(uint8_t e=0; e<EXTRUDERS; e++)
+  {
+    meta->material[e] = 0;
+    meta->nozzle_diameter[e] = 0.4;
+    meta->material_type[e][0] = '\0';
+  }
+  if (!f.open(&dir, dirEntry, O_READ))
+    return false;
+  readMetaHeader(f, meta);
+  f.close();
+  return true;
+}
+
+//Get the header information of the file found by the last getfilename call.
+bool CardReader::getfilemeta(gcode_meta_t* meta)
+{
+  filenameKey.dirCluster = workDir.firstCluster();
+#ifdef SD_GCODE_META_INDEX
+  if (metaIndexRead(filenameKey, meta))
+    return true;
+#endif
+  if (!readMeta(filenameKey.dirEntry, meta))
+    return false;
+#ifdef SD_GCODE_META_INDEX
+  metaIndexWrite(filenameKey, meta);
+#endif
+  return true;
+}
+
+#ifdef SD_GCODE_META_INDEX
+//First slot for a directory entry. The multiplicative hash spreads the entries of every folder over the whole index,
+//so folders do not take the same range of slots and evict each other.
+static uint16_t metaIndexHash(const gcode_meta_key_t& key)
+{
+  uint32_t h = (key.dirCluster * 0x9E3779B1UL) ^ key.dirEntry;
+  h *= 0x9E3779B1UL;
+  return (h >> 16) % SD_GCODE_META_INDEX_SLOTS;
+}
+
+//Look for the record of a directory entry in the META_INDEX_PROBES slots from its hash. Returns true with the record
+//when it is there. Otherwise slot is the first unused slot, or the first probe to overwrite when all of them are in use.
+//Records are never removed, so the entry can not be stored after an unused slot.
+static bool metaIndexFind(SdFile& file, const gcode_meta_key_t& key, gcode_meta_record_t* record, uint16_t* slot)
+{
+  uint16_t first = metaIndexHash(key);
+  *slot = first;
+  for(uint8_t n=0; n<META_INDEX_PROBES; n++)
+  {
+    uint16_t s = (first + n) % SD_GCODE_META_INDEX_SLOTS;
+    if (!file.seekSet(uint32_t(s) * sizeof(gcode_meta_record_t)) || file.read(record, sizeof(*record)) != sizeof(*record))
+      return false;
+    if (record->magic != META_INDEX_MAGIC)
+    {
+      *slot = s;
+      return false;
+    }
+    if (record->key.dirCluster == key.dirCluster && record->key.dirEntry == key.dirEntry)
+    {
+      *slot = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CardReader::metaIndexOpen()
+{
+  const uint32_t size = uint32_t(SD_GCODE_META_INDEX_SLOTS) * sizeof(gcode_meta_record_t);
+  if (metaFile.isOpen())
+    return true;
+  if (metaIndexFailed)
+    return false;
+  if (metaFile.open(&root, META_INDEX_FILENAME, O_RDWR))
+  {
+    if (metaFile.fileSize() == size)
+      return true;
+    //Made with other settings, start over.
+    metaFile.remove();
+  }
+  //The new file is not cleared, a record is only used when its magic and key match.
+  if (metaFile.createContiguous(&root, META_INDEX_FILENAME, size))
+    return true;
+  //Write protected or full card, browse without the index.
+  metaIndexFailed = true;
+  clearError();
+  return false;
+}
+
+bool CardReader::metaIndexRead(const gcode_meta_key_t& key, gcode_meta_t* meta)
+{
+  gcode_meta_record_t record;
+  uint16_t slot;
+  if (!metaIndexOpen())
+    return false;
+  if (!metaIndexFind(metaFile, key, &record, &slot))
+    return false;
+  //Same directory entry, but the file was replaced.
+  if (record.key.size != key.size || record.key.date != key.date || record.key.time != key.time)
+    return false;
+  if (meta)
+    *meta = record.meta;
+  return true;
+}
+
+void CardReader::metaIndexWrite(const gcode_meta_key_t& key, const gcode_meta_t* meta)
+{
+  gcode_meta_record_t record;
+  uint16_t slot;
+  if (!metaIndexOpen())
+    return;
+  metaIndexFind(metaFile, key, &record, &slot);
+  record.magic = META_INDEX_MAGIC;
+  record.key = key;
+  record.meta = *meta;
+  //Sync right away, so nothing is left in the cache when the card is pulled.
+  if (!metaFile.seekSet(uint32_t(slot) * sizeof(record)) || metaFile.write(&record, sizeof(record)) != sizeof(record) || !metaFile.sync())
+  {
+    metaFile.close();
+    metaIndexFailed = true;
+    clearError();
+  }
+}
+
+//Add one file of the working directory to the meta index, only while the printer is idle.
+void CardReader::metaIndexTick()
+{
+  SdFile dir;
+  dir_t p;
+  char lfn[LONG_FILENAME_LENGTH];
+  gcode_meta_key_t key;
+  gcode_meta_t meta;
+
+  if (!cardOK || sdprinting || saving || metaScanPos == META_SCAN_DONE || blocks_queued())
+    return;
+  if (millis() - metaScanMillis < META_SCAN_INTERVAL)
+    return;
+  metaScanMillis = millis();
+
+  dir = workDir;
+  if (!metaIndexOpen() || !dir.seekSet(metaScanPos) || dir.readDir(&p, lfn) <= 0)
+  {
+    metaScanPos = META_SCAN_DONE;
+    return;
+  }
+  metaScanPos = dir.curPosition();
+  if (!DIR_IS_FILE(&p) || !lsListed(p, lfn))
+    return;
+
+  key.dirCluster = workDir.firstCluster();
+  key.dirEntry = (metaScanPos >> 5) - 1;
+  key.size = p.fileSize;
+  key.date = p.lastWriteDate;
+  key.time = p.lastWriteTime;
+  if (metaIndexRead(key, NULL))
+    return;
+  if (readMeta(key.dirEntry, &meta))
+    metaIndexWrite(key, &meta);
+}
+#endif//SD_GCODE_META_INDEX
+
+#ifdef SD_PREHEAT_LOOKAHEAD
+//Blocks read ahead in one go. The print restarts its multiple block read after a scan, so scanning a few blocks at once
+//keeps both the print and the scan in a multiple block read most of the time.
+#define LOOKAHEAD_SCAN_BLOCKS 4
+//Bytes read from the card at a time, on the stack.
+#define LOOKAHEAD_SCAN_CHUNK 32
+#define READ_RATE_INTERVAL 4000
+
+//Follow the print with a second handle on the file, and start the hotend temperature changes it finds early.
+void CardReader::preheatTick()
+{
+  if (!sdprinting)
+  {
+    if (lookaheadActive)
+      lookaheadFile.close();
+    lookaheadActive = false;
+    return;
+  }
+  //Start at the print position, again when the print continues somewhere else (M26, resume). The print can also pass
+  //the scan when the scan waits for the planner, the scan then continues where it was and catches up.
+  if (!lookaheadActive || lookaheadResync)
+  {
+    lookaheadResync = false;
+    lookaheadFile = file;
+    if (!lookaheadFile.seekSet(sdpos))
+      lookaheadFile.close();
+    lookaheadActive = true;
+    lookaheadLinePos = sdpos;
+    lookaheadLen = 0;
+    lookaheadComment = false;
+    lookaheadExtruder = active_extruder;
+    for(uint8_t e=0; e<EXTRUDERS; e++)
+      lookaheadTemperature[e] = target_temperature[e];
+    preheatCount = 0;
+    readRate = 0;
+    readRatePos = sdpos;
+    readRateMillis = millis();
+  }
+
+  if (millis() - readRateMillis >= READ_RATE_INTERVAL)
+  {
+    readRate = (readRate + (sdpos - readRatePos) * 1000UL / (millis() - readRateMillis)) / 2;
+    readRatePos = sdpos;
+    readRateMillis = millis();
+  }
+
+  while(preheatCount > 0 && preheatQueue[0].pos < sdpos)
+  {
+    preheatCount--;
+    memmove(&preheatQueue[0], &preheatQueue[1], preheatCount * sizeof(preheat_change_t));
+  }
+  uint8_t waiting = 0; //Extruders with an earlier change that has not started yet.
+  for(uint8_t n=0; n<preheatCount; n++)
+  {
+    preheat_change_t* change = &preheatQueue[n];
+    if (change->started || (waiting & _BV(change->extruder)))
+      continue;
+    float lead = fabs(change->temperature - current_temperature[change->extruder]) / SD_PREHEAT_RATE * readRate;
+    if (change->pos < sdpos + lead)
+    {
+      setTargetHotend(change->temperature, change->extruder);
+      change->started = true;
+    }else{
+      waiting |= _BV(change->extruder);
+    }
+  }
+
+  if (lookaheadFile.isOpen() && preheatCount < SD_PREHEAT_QUEUE && movesplanned() >= BLOCK_BUFFER_SIZE / 2
+    && lookaheadLinePos + LOOKAHEAD_SCAN_BLOCKS * 512 < sdpos + SD_PREHEAT_LOOKAHEAD)
+    lookaheadScan();
+}
+
+void CardReader::lookaheadScan()
+{
+  //Read past the cache, the print keeps its block and only has to restart its multiple block read.
+  uint32_t end = (lookaheadFile.curPosition() & ~0x1FFUL) + LOOKAHEAD_SCAN_BLOCKS * 512UL;
+  while(lookaheadFile.curPosition() < end && preheatCount < SD_PREHEAT_QUEUE)
+  {
+    uint8_t data[LOOKAHEAD_SCAN_CHUNK];
+    int16_t n = lookaheadFile.readStreamed(data, sizeof(data));
+    if (n <= 0)
+    {
+      //End of the file, or a read error which the print itself will run into.
+      lookaheadFile.close();
+      lookaheadLinePos = filesize;
+      clearError();
+      return;
+    }
+    uint32_t pos = lookaheadFile.curPosition() - n;
+    for(uint8_t i=0; i<n; i++)
+    {
+      char c = data[i];
+      pos++;
+      if (c == '\n' || c == '\r' || (c == ':' && !lookaheadComment))
+      {
+        if (lookaheadLen > 0)
+          lookaheadLineDone();
+        lookaheadLen = 0;
+        lookaheadComment = false;
+        lookaheadLinePos = pos;
+        continue;
+      }
+      if (c == ';')
+        lookaheadComment = true;
+      if (!lookaheadComment && lookaheadLen < sizeof(lookaheadLine) - 1 && (lookaheadLen > 0 || c != ' '))
+        lookaheadLine[lookaheadLen++] = c;
+    }
+  }
+}
+
+void CardReader::lookaheadLineDone()
+{
+  char* end;
+  lookaheadLine[lookaheadLen] = '\0';
+  if (lookaheadLine[0] == 'T')
+  {
+    long nr = strtol(&lookaheadLine[1], &end, 10);
+    if (end != &lookaheadLine[1] && nr >= 0 && nr < EXTRUDERS)
+      lookaheadExtruder = nr;
+    return;
+  }
+  if (lookaheadLine[0] != 'M')
+    return;
+  long code = strtol(&lookaheadLine[1], &end, 10);
+  if (code != 104 && code != 109)
+    return;
+  char* ptr = strchr(end, 'S');
+  if (ptr == NULL)
+    return;
+  int16_t temperature = strtol(ptr + 1, NULL, 10);
+  uint8_t extruder = lookaheadExtruder;
+  ptr = strchr(end, 'T');
+  if (ptr != NULL)
+    extruder = strtol(ptr + 1, NULL, 10);
+  if (extruder >= EXTRUDERS || temperature == lookaheadTemperature[extruder])
+    return;
+  lookaheadTemperature[extruder] = temperature;
+  if (temperature <= 0)
+    return;
+  preheat_change_t* change = &preheatQueue[preheatCount++];
+  change->pos = lookaheadLinePos;
+  change->temperature = temperature;
+  change->extruder = extruder;
+  change->started = false;
+}
+#endif//SD_PREHEAT_LOOKAHEAD
+
+#ifdef SD_SORT
+//Folders come first, then by upper case name or newest first.
+static void sortKey(sd_sort_entry_t& e, const dir_t& p, const char* longFilename, uint8_t mode)
+{
+  memset(e.key, 0, sizeof(e.key));
+  e.key[0] = DIR_IS_SUBDIR(&p) ? 0 : 1;
+  if (mode == SD_SORT_BY_DATE)
+  {
+    e.key[1] = ~p.lastWriteDate >> 8;
+    e.key[2] = ~p.lastWriteDate;
+    e.key[3] = ~p.lastWriteTime >> 8;
+    e.key[4] = ~p.lastWriteTime;
+    return;
+  }
+  char shortName[13];
+  const char* name = longFilename[0] != '\0' ? longFilename : createFilename(shortName, p);
+  for(uint8_t i=1; i<sizeof(e.key) && *name; i++, name++)
+  {
+    char c = *name;
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    e.key[i] = c;
+  }
+}
+
+//Equal keys keep the directory order.
+static int8_t sortCompare(const sd_sort_entry_t& a, const sd_sort_entry_t& b)
+{
+  int r = memcmp(a.key, b.key, sizeof(a.key));
+  if (r != 0)
+    return r < 0 ? -1 : 1;
+  if (a.entry != b.entry)
+    return a.entry < b.entry ? -1 : 1;
+  return 0;
+}
+
+//Header the sort file needs to hold the order of dir: the listed files, with their names and dates, are summed up in one pass.
+static void sortHeader(SdFile& dir, char* longFilename, uint8_t mode, sd_sort_header_t* header)
+{
+  dir_t p;
+  memset(header, 0, sizeof(*header));
+  header->magic = SORT_MAGIC;
+  header->mode = mode;
+  header->dirCluster = dir.firstCluster();
+  dir.rewind();
+  while (dir.readDir(p, longFilename) > 0 && p.name[0] != DIR_NAME_FREE)
+  {
+    if (!lsListed(p, longFilename))
+      continue;
+    uint32_t sum = header->checksum ^ (dir.curPosition() >> 5) ^ (uint32_t(p.lastWriteDate) << 16) ^ p.lastWriteTime;
+    for(uint8_t i=0; i<11; i++)
+      sum = ((sum << 5) | (sum >> 27)) ^ p.name[i];
+    for(const char* c=longFilename; *c; c++)
+      sum = ((sum << 5) | (sum >> 27)) ^ *c;
+    header->checksum = sum;
+    header->count++;
+  }
+}
+
+//Use the order in the sort file when it was made for dir as it is now, else make it when build is set.
+bool CardReader::sortOpen(SdFile& dir, bool build)
+{
+  sd_sort_header_t header, stored;
+
+  sortValid = false;
+  sortCount = 0;
+  if (sortFailed)
+    return false;
+  if (!sortFile.isOpen() && !sortFile.open(&root, SORT_FILENAME, O_RDWR | O_CREAT))
+    return sortError();
+  sortHeader(dir, longFilename, sortMode, &header);
+  if (sortFile.seekSet(0) && sortFile.read(&stored, sizeof(stored)) == sizeof(stored) && memcmp(&stored, &header, sizeof(header)) == 0)
+  {
+    sortCount = header.count;
+    sortValid = true;
+    return true;
+  }
+  if (!build)
+    return false;
+  return sortBuild(dir, header);
+}
+
+//Write the order of the listed files in dir to the sort file. Every pass over the directory sorts the
+//SD_SORT_PASS_SIZE first files that come after the last file of the previous pass.
+//The header is written last, so an interrupted build is not used.
+bool CardReader::sortBuild(SdFile& dir, const sd_sort_header_t& header)
+{
+  sd_sort_entry_t sorted[SD_SORT_PASS_SIZE];
+  sd_sort_entry_t e, last;
+  dir_t p;
+  uint8_t n;
+  uint16_t count = 0;
+  bool ok = sortFile.seekSet(0) && sortFile.write(&count, sizeof(count)) == sizeof(count);
+
+  do
+  {
+    //A pass reads the whole folder, keep the heaters going in between.
+    manage_heater();
+    n = 0;
+    dir.rewind();
+    while (ok)
+    {
+      e.entry = dir.curPosition() >> 5;
+      if (dir.readDir(p, longFilename) <= 0 || p.name[0] == DIR_NAME_FREE)
+        break;
+      if (!lsListed(p, longFilename))
+        continue;
+      sortKey(e, p, longFilename, sortMode);
+      if (count > 0 && sortCompare(e, last) <= 0)
+        continue;
+      if (n == SD_SORT_PASS_SIZE && sortCompare(e, sorted[n - 1]) >= 0)
+        continue;
+      if (n < SD_SORT_PASS_SIZE)
+        n++;
+      uint8_t i = n - 1;
+      for(; i > 0 && sortCompare(e, sorted[i - 1]) < 0; i--)
+        sorted[i] = sorted[i - 1];
+      sorted[i] = e;
+    }
+    if (ok && n > 0)
+      ok = sortFile.seekSet(sizeof(sd_sort_header_t) + uint32_t(count) * sizeof(uint16_t));
+    for(uint8_t i=0; ok && i<n; i++)
+      ok = sortFile.write(&sorted[i].entry, sizeof(uint16_t)) == sizeof(uint16_t);
+    if (n > 0)
+      last = sorted[n - 1];
+    count += n;
+  } while (ok && n == SD_SORT_PASS_SIZE);
+
+  ok = ok && count == header.count && sortFile.seekSet(0) && sortFile.write(&header, sizeof(header)) == sizeof(header);
+  if (ok && sortFile.sync())
+  {
+    sortCount = count;
+    sortValid = true;
+    return true;
+  }
+  return sortError();
+}
+
+//Write protected or full card, list in directory order.
+bool CardReader::sortError()
+{
+  if (sortFile.isOpen())
+    sortFile.close();
+  sortFailed = true;
+  sortValid = false;
+  sortCount = 0;
+  clearError();
+  return false;
+}
+
+bool CardReader::sortRead(uint16_t nr, uint16_t* entry)
+{
+  if (nr >= sortCount)
+    return false;
+  return sortFile.seekSet(sizeof(sd_sort_header_t) + uint32_t(nr) * sizeof(uint16_t)) && sortFile.read(entry, sizeof(uint16_t)) == sizeof(uint16_t);
+}
+
+//M20 listing with the files of every folder in sort order. While a file is open the order is not made,
+//the folders without a stored order are listed in directory order then.
+void CardReader::lsSorted(const char *prepend, SdFile& parent)
+{
+  dir_t p;
+  uint16_t entry;
+
+  if (!sortOpen(parent, !isFileOpen()))
+  {
+    parent.rewind();
+    lsDive(prepend, parent);
+    return;
+  }
+  for(uint16_t nr=0; sortRead(nr, &entry); nr++)
+  {
+    if (!parent.seekSet(uint32_t(entry) << 5) || parent.readDir(p, longFilename) <= 0)
+      break;
+    if (DIR_IS_SUBDIR(&p))
+      continue;
+    createFilename(filename,p);
+    SERIAL_PROTOCOL(prepend);
+    SERIAL_PROTOCOLLN(filename);
+  }
+
+  //A subfolder replaces the sort file with its own order, so subfolders are visited in directory order.
+  parent.rewind();
+  while (parent.readDir(p, longFilename) > 0 && p.name[0] != DIR_NAME_FREE)
+  {
+    if (!DIR_IS_SUBDIR(&p) || !lsListed(p, longFilename))
+      continue;
+    char path[13*2];
+    char lfilename[13];
+    createFilename(lfilename,p);
+
+    path[0]=0;
+    if(strlen(prepend)==0) //avoid leading / if already in prepend
+    {
+     strcat(path,"/");
+    }
+    strcat(path,prepend);
+    strcat(path,lfilename);
+    strcat(path,"/");
+
+    uint32_t pos = parent.curPosition();
+    SdFile dir;
+    if(dir.open(parent,lfilename, O_READ))
+      lsSorted(path,dir);
+    parent.seekSet(pos);
+  }
+}
+
+void CardReader::setSortMode(uint8_t mode)
+{
+  if (mode == sortMode || mode > SD_SORT_BY_DATE)
+    return;
+  sortMode = mode;
+  sortValid = false;
+  eeprom_write_byte((uint8_t*)SORT_MODE_EEPROM_OFFSET, mode);
+}
+#endif//SD_SORT
+
+void CardReader::workDirChanged()
+{
+#if SD_DIR_INDEX_SIZE > 0
+  dirIndexCount = 0;
+#endif
+#ifdef SD_GCODE_META_INDEX
+  metaScanPos = 0;
+#endif
+#ifdef SD_SORT
+  sortValid = false;
+#endif
+}
+
 uint16_t CardReader::getnrfilenames()
 {
   curDir=&workDir;
   lsAction=LS_Count;
   nrFiles=0;
+#ifdef SD_SORT
+  if (sortMode != SD_SORT_NONE && (sortValid || sortOpen(workDir, true)))
+    return sortCount;
+#endif
+#if SD_DIR_INDEX_SIZE > 0
+  dirIndexCount = 0;
+  dirIndexShift = 0;
+#endif
   curDir->rewind();
   lsDive("",*curDir);
   //SERIAL_ECHOLN(nrFiles);
@@ -546,6 +1347,7 @@ void CardReader::chdir(const char * relpath)
       workDirParents[0]=*parent;
     }
     workDir=newfile;
+    workDirChanged();
   }
 }
 
@@ -557,6 +1359,7 @@ void CardReader::updir()
     workDir = workDirParents[0];
     for (uint8_t d = 0; d < workDirDepth; d++)
       workDirParents[d] = workDirParents[d+1];
+    workDirChanged();
   }
 }
 
@@ -18,6 +18,53 @@
 
 #include "SdFile.h"
 enum LsAction {LS_SerialPrint,LS_Count,LS_GetFilename};
+#define SD_SORT_NONE 0
+#define SD_SORT_BY_NAME 1
+#define SD_SORT_BY_DATE 2
+
+//Information from the comment header of a G-code file, shown by the file browser.
+struct gcode_meta_t
+{
+  unsigned long time;
+  unsigned long material[EXTRUDERS];
+  float nozzle_diameter[EXTRUDERS];
+  char material_type[EXTRUDERS][8];
+};
+
+#ifdef SD_PREHEAT_LOOKAHEAD
+#define SD_PREHEAT_QUEUE 4
+//A hotend temperature change found ahead in the print file.
+struct preheat_change_t
+{
+  uint32_t pos;
+  int16_t temperature;
+  uint8_t extruder;
+  bool started;
+};
+#endif
+
+//A file in the meta index, by directory entry. The size and modification time detect changed files.
+#ifdef SD_SORT
+//Start of the sort file, the folder and listing the order was made for. The entry numbers follow it.
+struct sd_sort_header_t
+{
+  uint16_t magic;
+  uint8_t mode;
+  uint32_t dirCluster;
+  uint16_t count;
+  uint32_t checksum;
+};
+#endif
+
+struct gcode_meta_key_t
+{
+  uint32_t dirCluster;
+  uint32_t size;
+  uint16_t dirEntry;
+  uint16_t date;
+  uint16_t time;
+};
+
 class CardReader
 {
 public:
@@ -36,30 +83,55 @@ public:
   void closefile();
   void release();
   void startFileprint();
+#ifdef POWER_LOSS_RESUME
+  bool resumeFile(uint32_t dirBlock, uint8_t dirIndex, uint32_t size, uint32_t pos);
+#endif
   void pauseSDPrint();
   void getStatus();
   void printingHasFinished();
 
-  void getfilename(const uint8_t nr);
+  void getfilename(const uint16_t nr);
   uint16_t getnrfilenames();
+  bool getfilemeta(gcode_meta_t* meta);
+#ifdef SD_GCODE_META_INDEX
+  void metaIndexTick();
+#endif
+#ifdef SD_PREHEAT_LOOKAHEAD
+  void preheatTick();
+#endif
 
 
   void ls();
   void chdir(const char * relpath);
   void updir();
   void setroot();
+#ifdef SD_SORT
+  void setSortMode(uint8_t mode);
+  FORCE_INLINE uint8_t getSortMode() { return sortMode; }
+#endif
 
 
   FORCE_INLINE bool isFileOpen() { return file.isOpen(); }
   FORCE_INLINE bool eof() { return sdpos>=filesize ;};
-  FORCE_INLINE int16_t get() {  sdpos = file.curPosition();return (int16_t)file.read();};
+  int16_t getLine(char* str, int16_t size);
+#if USE_BLOCK_PREFETCH
+  FORCE_INLINE void prefetch() { if (sdprinting) file.prefetch(); };
+#endif
   FORCE_INLINE int16_t fgets(char* str, int16_t num) { return file.fgets(str, num, NULL); }
-  FORCE_INLINE void setIndex(long index) {sdpos = index;file.seekSet(index);};
+  FORCE_INLINE void setIndex(long index)
+  {
+    sdpos = index;readLeft = 0;file.seekSet(index);
+#ifdef SD_PREHEAT_LOOKAHEAD
+    lookaheadResync = true;
+#endif
+  };
   FORCE_INLINE uint8_t percentDone(){if(!isFileOpen()) return 0; if(filesize) return sdpos/((filesize+99)/100); else return 0;};
   FORCE_INLINE char* getWorkDirName(){workDir.getFilename(filename);return filename;};
   FORCE_INLINE bool atRoot() { return workDirDepth==0; }
   FORCE_INLINE uint32_t getFilePos() { return sdpos; }
   FORCE_INLINE uint32_t getFileSize() { return filesize; }
+  FORCE_INLINE uint32_t getFileDirBlock() { return file.dirBlock(); }
+  FORCE_INLINE uint8_t getFileDirIndex() { return file.dirIndex(); }
   FORCE_INLINE bool isOk() { return cardOK && card.errorCode() == 0; }
   FORCE_INLINE int errorCode() { return card.errorCode(); }
   FORCE_INLINE void clearError() { card.error(0); }
@@ -99,12 +171,62 @@ private:
   //int16_t n;
   unsigned long autostart_atmillis;
   uint32_t sdpos ;
+  const uint8_t* readPtr; //Unprocessed data of the current block in the volume cache, used by getLine.
+  uint16_t readLeft;
 
   bool autostart_stilltocheck; //the sd start is delayed, because otherwise the serial cannot answer fast enought to make contact with the hostsoftware.
 
   LsAction lsAction; //stored for recursion.
   int16_t nrFiles; //counter for the files in the current directory and recycled as position counter for getting the nrFiles'th name in the directory.
   char* diveDirName;
+#if SD_DIR_INDEX_SIZE > 0
+  uint16_t dirIndex[SD_DIR_INDEX_SIZE]; //Directory entry number of every (1 << dirIndexShift)'th file in workDir, filled by getnrfilenames.
+  uint8_t dirIndexCount;
+  uint8_t dirIndexShift;
+  void dirIndexAdd(uint16_t entry);
+#endif
+  gcode_meta_key_t filenameKey; //Directory entry of the file found by getfilename.
+#ifdef SD_GCODE_META_INDEX
+  SdFile metaFile;
+  bool metaIndexFailed;
+  uint32_t metaScanPos; //Position in workDir of the next file to add to the meta index.
+  unsigned long metaScanMillis;
+  bool metaIndexOpen();
+  bool metaIndexRead(const gcode_meta_key_t& key, gcode_meta_t* meta);
+  void metaIndexWrite(const gcode_meta_key_t& key, const gcode_meta_t* meta);
+#endif
+#ifdef SD_PREHEAT_LOOKAHEAD
+  SdBaseFile lookaheadFile; //Second handle on the print file, reads ahead of file.
+  bool lookaheadActive;
+  bool lookaheadResync; //The print was moved (new file, M26, resume), start the scan again at sdpos.
+  uint32_t lookaheadLinePos; //File position of the line in lookaheadLine.
+  char lookaheadLine[20]; //Start of the line being scanned, without comment.
+  uint8_t lookaheadLen;
+  bool lookaheadComment;
+  uint8_t lookaheadExtruder; //Tool selected at the scan position.
+  int16_t lookaheadTemperature[EXTRUDERS]; //Hotend temperatures at the scan position.
+  preheat_change_t preheatQueue[SD_PREHEAT_QUEUE];
+  uint8_t preheatCount;
+  uint16_t readRate; //Bytes of the file the print uses per second.
+  uint32_t readRatePos;
+  unsigned long readRateMillis;
+  void lookaheadScan();
+  void lookaheadLineDone();
+#endif
+  bool readMeta(uint16_t dirEntry, gcode_meta_t* meta);
+#ifdef SD_SORT
+  SdFile sortFile; //Directory entry numbers of the listed files of one folder, in sort order.
+  bool sortFailed;
+  bool sortValid; //sortFile holds the order of workDir, checked since workDir last changed.
+  uint8_t sortMode;
+  uint16_t sortCount;
+  bool sortOpen(SdFile& dir, bool build);
+  bool sortBuild(SdFile& dir, const sd_sort_header_t& header);
+  bool sortError();
+  bool sortRead(uint16_t nr, uint16_t* entry);
+  void lsSorted(const char *prepend, SdFile& parent);
+#endif
+  void workDirChanged();
   void lsDive(const char *prepend,SdFile parent);
 };
 extern CardReader card;
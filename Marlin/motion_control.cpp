@@ -23,8 +23,27 @@
 #include "stepper.h"
 #include "planner.h"
 
-// The arc is approximated by generating a huge number of tiny, linear segments. The length of each
-// segment is configured in settings.mm_per_arc_segment.
+// The arc is approximated by generating a number of linear segments. The length of each segment
+// follows from the radius and ARC_CHORD_TOLERANCE, see mc_arc_segment_length().
+static float mc_arc_segment_length(float radius, float feed_rate)
+{
+  // A chord of length c on a circle with radius r is at most r - sqrt(r^2 - c^2/4) away from the arc.
+  // Solving that for the tolerance gives c = 2 * sqrt(2 * r * tol - tol^2).
+  float mm_per_segment = MAX_MM_PER_ARC_SEGMENT;
+  if (radius > ARC_CHORD_TOLERANCE)
+    mm_per_segment = 2 * sqrt(ARC_CHORD_TOLERANCE * (2 * radius - ARC_CHORD_TOLERANCE));
+  if (mm_per_segment > MAX_MM_PER_ARC_SEGMENT)
+    mm_per_segment = MAX_MM_PER_ARC_SEGMENT;
+
+  // Shorter segments than the distance traveled in minsegmenttime (us) would be slowed down by the planner anyhow.
+  float min_mm_per_segment = feed_rate * minsegmenttime / 1000000.0;
+  if (min_mm_per_segment < MIN_MM_PER_ARC_SEGMENT)
+    min_mm_per_segment = MIN_MM_PER_ARC_SEGMENT;
+  if (mm_per_segment < min_mm_per_segment)
+    mm_per_segment = min_mm_per_segment;
+  return mm_per_segment;
+}
+
 void mc_arc(float *position, float *target, float *offset, uint8_t axis_0, uint8_t axis_1,
   uint8_t axis_linear, float feed_rate, float radius, uint8_t isclockwise, uint8_t extruder)
 {
@@ -46,7 +65,7 @@ void mc_arc(float *position, float *target, float *offset, uint8_t axis_0, uint8
 
   float millimeters_of_travel = hypot(angular_travel*radius, fabs(linear_travel));
   if (millimeters_of_travel < 0.001) { return; }
-  uint16_t segments = floor(millimeters_of_travel/MM_PER_ARC_SEGMENT);
+  uint16_t segments = ceil(millimeters_of_travel/mc_arc_segment_length(radius, feed_rate));
   if(segments == 0) segments = 1;
 
   /*
@@ -72,21 +91,14 @@ void mc_arc(float *position, float *target, float *offset, uint8_t axis_0, uint8
      round off issues for CNC applications.) Single precision error can accumulate to be greater than
      tool precision in some cases. Therefore, arc path correction is implemented.
 
-     Small angle approximation may be used to reduce computation overhead further. This approximation
-     holds for everything, but very small circles and large mm_per_arc_segment values. In other words,
-     theta_per_segment would need to be greater than 0.1 rad and N_ARC_CORRECTION would need to be large
-     to cause an appreciable drift error. N_ARC_CORRECTION~=25 is more than small enough to correct for
-     numerical drift error. N_ARC_CORRECTION may be on the order a hundred(s) before error becomes an
-     issue for CNC machines with the single precision Arduino calculations.
-
-     This approximation also allows mc_arc to immediately insert a line segment into the planner
-     without the initial overhead of computing cos() or sin(). By the time the arc needs to be applied
-     a correction, the planner should have caught up to the lag caused by the initial mc_arc overhead.
-     This is important when there are successive arc motions.
+     The small angle approximation that used to be here does not hold with the segment length
+     following the chord tolerance, small circles can get theta_per_segment well above 0.1 rad.
+     So the rotation matrix is computed exactly, which costs one cos() and sin() per arc.
+     N_ARC_CORRECTION~=25 is more than small enough to correct for numerical drift error.
   */
   // Vector rotation matrix values
-  float cos_T = 1-0.5*theta_per_segment*theta_per_segment; // Small angle approximation
-  float sin_T = theta_per_segment;
+  float cos_T = cos(theta_per_segment);
+  float sin_T = sin(theta_per_segment);
 
   float arc_target[4];
   float sin_Ti;
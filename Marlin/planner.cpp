@@ -56,6 +56,7 @@
 #include "stepper.h"
 #include "temperature.h"
 #include "lifetime_stats.h"
+#include "power_resume.h"
 #include "ultralcd.h"
 #include "UltiLCD2.h"
 #include "language.h"
@@ -111,6 +112,28 @@ static long x_segment_time[3]={MAX_FREQ_TIME + 1,0,0};     // Segment times (in
 static long y_segment_time[3]={MAX_FREQ_TIME + 1,0,0};
 #endif
 
+#ifdef SEGMENT_COALESCING
+// The movement that is held back to be merged with the next one.
+static bool coalesce_pending = false;
+static float coalesce_start[NUM_AXIS];
+static float coalesce_target[NUM_AXIS];
+static float coalesce_feed_rate;
+static uint8_t coalesce_extruder;
+static uint8_t coalesce_fan_speed;
+static int coalesce_extrudemultiply;
+static float coalesce_volume_to_filament_length;
+// Upper bound of the distance between the corners merged so far and the line from coalesce_start to coalesce_target.
+static float coalesce_deviation;
+#ifdef POWER_LOSS_RESUME
+static uint32_t coalesce_file_pos;
+#endif
+#endif
+
+#ifdef POWER_LOSS_RESUME
+static uint32_t command_file_pos;
+static bool command_first_block; // The command at command_file_pos did not add a block yet.
+#endif
+
 // Returns the index of the next block in the ring buffer
 // NOTE: Removed modulo (%) operator, which uses an expensive divide and multiplication.
 static int8_t next_block_index(int8_t block_index) {
@@ -520,6 +543,11 @@ float junction_deviation = 0.1;
 // calculation the caller must also provide the physical length of the line in millimeters.
 void plan_buffer_line(const float &x, const float &y, const float &z, const float &e, float feed_rate, const uint8_t &extruder)
 {
+#ifdef SEGMENT_COALESCING
+  // A held back movement goes before this one.
+  plan_flush_coalesced();
+#endif
+
   // Calculate the buffer head after we push this byte
   int next_buffer_head = next_block_index(block_buffer_head);
 
@@ -531,6 +559,9 @@ void plan_buffer_line(const float &x, const float &y, const float &z, const floa
     manage_inactivity();
     lcd_update();
     lifetime_stats_tick();
+#ifdef POWER_LOSS_RESUME
+    power_resume_tick();
+#endif
   }
 
   // The target position of the tool in absolute steps
@@ -593,6 +624,12 @@ block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-positi
   }
 
   block->fan_speed = fanSpeed;
+  #ifdef POWER_LOSS_RESUME
+  block->file_pos = command_file_pos;
+  block->extrude_multiply = extrudemultiply[extruder];
+  block->command_start = command_first_block;
+  command_first_block = false;
+  #endif
   #ifdef BARICUDA
   block->valve_pressure = ValvePressure;
   block->e_to_p_pressure = EtoPPressure;
@@ -883,6 +920,11 @@ block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-positi
   memcpy(previous_speed, current_speed, sizeof(previous_speed)); // previous_speed[] = current_speed[]
   previous_nominal_speed = block->nominal_speed;
 
+#ifdef PID_ADD_EXTRUSION_RATE
+  block->e_rate = current_speed[E_AXIS] > 0 ? min(current_speed[E_AXIS] * (1 << PLAN_E_RATE_SHIFT), 65535.0) : 0;
+  block->duration = block->millimeters / block->nominal_speed * 1000000.0;
+#endif
+
 
 #ifdef ADVANCE
   // Calculate advance rate
@@ -924,8 +966,191 @@ block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-positi
   st_wake_up();
 }
 
+#ifdef SEGMENT_COALESCING
+// Check if the held back movement and the segment to target can be replaced by a single line.
+static bool coalesce_can_merge(const float* target, float feed_rate, const uint8_t &extruder, float* deviation)
+{
+  if (extruder != coalesce_extruder || feed_rate != coalesce_feed_rate || fanSpeed != coalesce_fan_speed)
+    return false;
+  if (extrudemultiply[extruder] != coalesce_extrudemultiply || volume_to_filament_length[extruder] != coalesce_volume_to_filament_length)
+    return false;
+
+  float a[3], b[3]; // a: the held back movement, b: the new segment
+  for(int8_t i=0; i < 3; i++)
+  {
+    a[i] = coalesce_target[i] - coalesce_start[i];
+    b[i] = target[i] - coalesce_target[i];
+  }
+  float len_a = sqrt(square(a[X_AXIS]) + square(a[Y_AXIS]) + square(a[Z_AXIS]));
+  float len_b = sqrt(square(b[X_AXIS]) + square(b[Y_AXIS]) + square(b[Z_AXIS]));
+  // Extrude only moves are never merged, these are retractions.
+  if (len_a < 0.000001 || len_b < 0.000001)
+    return false;
+  if (len_a + len_b > COALESCE_MAX_LENGTH)
+    return false;
+
+  // Angle between the two.
+  float dot = a[X_AXIS] * b[X_AXIS] + a[Y_AXIS] * b[Y_AXIS] + a[Z_AXIS] * b[Z_AXIS];
+  if (dot < COALESCE_MIN_COS * len_a * len_b)
+    return false;
+
+  // Distance of the corner to the merged line, |a x b| / |a + b|. The corners merged before are at most their old deviation
+  // from the held line, and every point of the held line is at most this far from the merged line, so the sum bounds all of them.
+  float cross = sqrt(square(a[Y_AXIS] * b[Z_AXIS] - a[Z_AXIS] * b[Y_AXIS]) + square(a[Z_AXIS] * b[X_AXIS] - a[X_AXIS] * b[Z_AXIS]) + square(a[X_AXIS] * b[Y_AXIS] - a[Y_AXIS] * b[X_AXIS]));
+  float len_ab = sqrt(square(a[X_AXIS] + b[X_AXIS]) + square(a[Y_AXIS] + b[Y_AXIS]) + square(a[Z_AXIS] + b[Z_AXIS]));
+  *deviation = coalesce_deviation + cross / len_ab;
+  if (*deviation > COALESCE_MAX_DEVIATION)
+    return false;
+
+  // Both need the same extrusion per mm, so the merged line extrudes the same amount at every point.
+  float e_a = coalesce_target[E_AXIS] - coalesce_start[E_AXIS];
+  float e_b = target[E_AXIS] - coalesce_target[E_AXIS];
+  if (fabs(e_a * len_b - e_b * len_a) > COALESCE_E_RATIO_TOLERANCE * fabs(e_a * len_b))
+    return false;
+  return true;
+}
+
+void plan_buffer_line_coalesced(const float* start, const float* target, float feed_rate, const uint8_t &extruder)
+{
+  if (coalesce_pending)
+  {
+    float deviation;
+    if (coalesce_can_merge(target, feed_rate, extruder, &deviation))
+    {
+      memcpy(coalesce_target, target, sizeof(coalesce_target));
+      coalesce_deviation = deviation;
+      return;
+    }
+    plan_flush_coalesced();
+  }
+  // Do not hold back anything when the planner is about to run empty.
+  if (movesplanned() < 2)
+  {
+    plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feed_rate, extruder);
+    return;
+  }
+  memcpy(coalesce_start, start, sizeof(coalesce_start));
+  memcpy(coalesce_target, target, sizeof(coalesce_target));
+  coalesce_feed_rate = feed_rate;
+  coalesce_extruder = extruder;
+  coalesce_fan_speed = fanSpeed;
+  coalesce_extrudemultiply = extrudemultiply[extruder];
+  coalesce_volume_to_filament_length = volume_to_filament_length[extruder];
+  coalesce_deviation = 0;
+#ifdef POWER_LOSS_RESUME
+  coalesce_file_pos = command_file_pos;
+#endif
+  coalesce_pending = true;
+}
+
+void plan_flush_coalesced()
+{
+  if (!coalesce_pending)
+    return;
+  coalesce_pending = false;
+  // The fan speed is stored in the block, make sure it is the speed that was set when this move was given.
+  uint8_t fan_speed = fanSpeed;
+  fanSpeed = coalesce_fan_speed;
+  // The flow settings could have changed since, the held move extrudes with the ones it was given with.
+  int extrude_multiply = extrudemultiply[coalesce_extruder];
+  float filament_length = volume_to_filament_length[coalesce_extruder];
+  extrudemultiply[coalesce_extruder] = coalesce_extrudemultiply;
+  volume_to_filament_length[coalesce_extruder] = coalesce_volume_to_filament_length;
+#ifdef POWER_LOSS_RESUME
+  // Same for the file position, the merged move starts at the first command that was merged.
+  uint32_t file_pos = command_file_pos;
+  bool first_block = command_first_block;
+  command_file_pos = coalesce_file_pos;
+  command_first_block = true;
+#endif
+  plan_buffer_line(coalesce_target[X_AXIS], coalesce_target[Y_AXIS], coalesce_target[Z_AXIS], coalesce_target[E_AXIS], coalesce_feed_rate, coalesce_extruder);
+  fanSpeed = fan_speed;
+  extrudemultiply[coalesce_extruder] = extrude_multiply;
+  volume_to_filament_length[coalesce_extruder] = filament_length;
+#ifdef POWER_LOSS_RESUME
+  command_file_pos = file_pos;
+  command_first_block = first_block;
+#endif
+}
+
+void plan_discard_coalesced()
+{
+  coalesce_pending = false;
+}
+#endif//SEGMENT_COALESCING
+
+#ifdef POWER_LOSS_RESUME
+void plan_set_file_position(uint32_t file_pos)
+{
+  command_file_pos = file_pos;
+  command_first_block = true;
+}
+
+bool plan_get_resume_point(uint32_t* file_pos, float* pos)
+{
+  long start[NUM_AXIS];
+  bool command_start = true;
+  *file_pos = command_file_pos;
+  #ifdef SEGMENT_COALESCING
+  if (coalesce_pending)
+    *file_pos = coalesce_file_pos;
+  #endif
+  memcpy(start, position, sizeof(start));
+
+  // Undo the queued blocks from the newest to the one that is executed now. A finished block is not
+  // overwritten before the next plan_buffer_line, so only the tail has to be read atomically.
+  int8_t tail = block_buffer_tail;
+  for(int8_t i = block_buffer_head; i != tail; )
+  {
+    i = prev_block_index(i);
+    block_t* block = &block_buffer[i];
+    #ifndef COREXY
+    start[X_AXIS] += (block->direction_bits & (1<<X_AXIS)) ? block->steps_x : -block->steps_x;
+    start[Y_AXIS] += (block->direction_bits & (1<<Y_AXIS)) ? block->steps_y : -block->steps_y;
+    #else
+    #error POWER_LOSS_RESUME does not support COREXY
+    #endif
+    start[Z_AXIS] += (block->direction_bits & (1<<Z_AXIS)) ? block->steps_z : -block->steps_z;
+    // steps_e includes the extrude multiply that was set when the block was planned, it can have been changed since.
+    long steps_e = block->extrude_multiply > 0 ? block->steps_e * 100 / block->extrude_multiply : 0;
+    start[E_AXIS] += (block->direction_bits & (1<<E_AXIS)) ? steps_e : -steps_e;
+    *file_pos = block->file_pos;
+    command_start = block->command_start;
+  }
+  // The blocks before the executed one are gone, an arc can only be continued from its start.
+  if (!command_start)
+    return false;
+  for(int8_t i=0; i < NUM_AXIS; i++)
+    pos[i] = float(start[i]) / axis_steps_per_unit[i];
+  pos[E_AXIS] /= volume_to_filament_length[active_extruder];
+  return true;
+}
+#endif//POWER_LOSS_RESUME
+
+#ifdef PID_ADD_EXTRUSION_RATE
+uint16_t plan_get_e_rate_ahead(uint8_t extruder, unsigned int lookahead_ms)
+{
+  // The running block is counted as a whole, so this can look up to one block further ahead than asked.
+  // When the queue ends before lookahead_ms the newest block is the best guess of what follows.
+  unsigned long lookahead = lookahead_ms * 1000UL;
+  unsigned long time = 0;
+  uint16_t e_rate = 0;
+  uint8_t head = block_buffer_head;
+  for(uint8_t i = block_buffer_tail; i != head && time <= lookahead; i = next_block_index(i))
+  {
+    block_t* block = &block_buffer[i];
+    e_rate = (block->active_extruder == extruder) ? block->e_rate : 0;
+    time += block->duration;
+  }
+  return e_rate;
+}
+#endif//PID_ADD_EXTRUSION_RATE
+
 void plan_set_position(const float &x, const float &y, const float &z, const float &e)
 {
+#ifdef SEGMENT_COALESCING
+  plan_flush_coalesced();
+#endif
   position[X_AXIS] = lround(x*axis_steps_per_unit[X_AXIS]);
   position[Y_AXIS] = lround(y*axis_steps_per_unit[Y_AXIS]);
   position[Z_AXIS] = lround(z*axis_steps_per_unit[Z_AXIS]);
@@ -940,6 +1165,9 @@ void plan_set_position(const float &x, const float &y, const float &z, const flo
 
 void plan_set_e_position(const float &e)
 {
+#ifdef SEGMENT_COALESCING
+  plan_flush_coalesced();
+#endif
   position[E_AXIS] = lround(e*axis_steps_per_unit[E_AXIS]*volume_to_filament_length[active_extruder]);
   st_set_e_position(position[E_AXIS]);
 }
@@ -60,6 +60,15 @@ typedef struct {
   unsigned long final_rate;                          // The minimal rate at exit
   unsigned long acceleration_st;                     // acceleration steps/sec^2
   unsigned long fan_speed;
+  #ifdef PID_ADD_EXTRUSION_RATE
+  uint16_t e_rate;                                   // Extrusion speed in 1/64 mm/sec of filament, 0 for retractions
+  unsigned long duration;                            // Time at the nominal speed in microseconds
+  #endif
+  #ifdef POWER_LOSS_RESUME
+  uint32_t file_pos;                                 // SD file position of the command that added this block
+  int extrude_multiply;                              // Extrude multiply that was applied to steps_e
+  bool command_start;                                // First block of that command, G2/G3 add more than one
+  #endif
   #ifdef BARICUDA
   unsigned long valve_pressure;
   unsigned long e_to_p_pressure;
@@ -74,6 +83,37 @@ void plan_init();
 // millimaters. Feed rate specifies the speed of the motion.
 void plan_buffer_line(const float &x, const float &y, const float &z, const float &e, float feed_rate, const uint8_t &extruder);
 
+#ifdef SEGMENT_COALESCING
+// Add a new linear movement from start to target, but hold it back so it can be merged with the next
+// movement when both are on a straight line. Used by prepare_move for G0/G1.
+void plan_buffer_line_coalesced(const float* start, const float* target, float feed_rate, const uint8_t &extruder);
+// Send a held back movement to the planner. Called before anything that needs the planner to be up to date.
+void plan_flush_coalesced();
+// Forget a held back movement, used when aborting all moves.
+void plan_discard_coalesced();
+#else
+FORCE_INLINE void plan_buffer_line_coalesced(const float* start, const float* target, float feed_rate, const uint8_t &extruder)
+{
+  plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feed_rate, extruder);
+}
+FORCE_INLINE void plan_flush_coalesced() {}
+FORCE_INLINE void plan_discard_coalesced() {}
+#endif
+
+#ifdef PID_ADD_EXTRUSION_RATE
+#define PLAN_E_RATE_SHIFT 6
+// Get the extrusion speed of an extruder lookahead_ms from now, in 1/64 mm/sec of filament, from the queued moves.
+uint16_t plan_get_e_rate_ahead(uint8_t extruder, unsigned int lookahead_ms);
+#endif
+
+#ifdef POWER_LOSS_RESUME
+// Set the SD file position of the command that is processed now, it is stored in the blocks it adds.
+void plan_set_file_position(uint32_t file_pos);
+// Get the SD file position of the oldest command that is not finished and, in pos, the position in G-code
+// coordinates where that command started. False when part of that command is already done (an arc), try again later.
+bool plan_get_resume_point(uint32_t* file_pos, float* pos);
+#endif
+
 // Set position. Used for G92 instructions.
 void plan_set_position(const float &x, const float &y, const float &z, const float &e);
 void plan_set_e_position(const float &e);
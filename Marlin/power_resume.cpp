@@ -0,0 +1,248 @@
+#include <avr/eeprom.h>
+#include <stddef.h>
+#include "Marlin.h"
+#include "planner.h"
+#include "temperature.h"
+#include "cardreader.h"
+#include "power_resume.h"
+
+#ifdef POWER_LOSS_RESUME
+#ifndef SDSUPPORT
+#error POWER_LOSS_RESUME needs SDSUPPORT
+#endif
+
+//The material change settings end at 0x450 and the lifetime stats start at 0x700, the resume data is stored in between:
+//a header for the print at 0x480, followed by the ring of checkpoint slots.
+#define POWER_RESUME_EEPROM_OFFSET 0x480
+#define POWER_RESUME_HEADER ((uint8_t*)POWER_RESUME_EEPROM_OFFSET)
+#define POWER_RESUME_SLOT_ADDRESS(n) (POWER_RESUME_EEPROM_OFFSET + 0x10 + (n) * sizeof(resume_checkpoint_t))
+#define POWER_RESUME_SLOT(n) ((uint8_t*)POWER_RESUME_SLOT_ADDRESS(n))
+#define POWER_RESUME_MAGIC 0x5052
+
+#define MILLIS_CHECKPOINT (POWER_LOSS_CHECKPOINT_INTERVAL * 1000UL)
+
+//Written when an SD print starts. The file is found again by its directory entry, the magic is written last and cleared when the print ends.
+struct resume_header_t
+{
+    uint32_t first_sequence;
+    uint32_t dir_block;
+    uint32_t file_size;
+    uint8_t dir_index;
+    uint16_t magic;
+};
+
+//The newest slot with a valid checksum is the last checkpoint. A slot that was being written when the power failed has a bad checksum.
+struct resume_checkpoint_t
+{
+    uint32_t sequence;
+    uint32_t file_pos;
+    float position[NUM_AXIS];
+    float feedrate;
+    int16_t target_temperature[EXTRUDERS];
+    int16_t target_temperature_bed;
+    uint8_t fan_speed;
+    uint8_t extruder;
+    uint8_t checksum;
+};
+
+typedef char power_resume_eeprom_check[(sizeof(resume_header_t) <= 0x10 && POWER_RESUME_SLOT_ADDRESS(POWER_LOSS_CHECKPOINT_SLOTS) <= 0x700) ? 1 : -1];
+
+static resume_header_t header;
+static resume_checkpoint_t checkpoint; //Newest checkpoint, also the source of the EEPROM write while it is written.
+static uint8_t next_slot;
+static bool is_printing;
+static bool resume_found;
+static uint8_t resume_stage;
+static unsigned long checkpoint_millis;
+
+//EEPROM write in progress, one byte is written each time the EEPROM is ready.
+static const uint8_t* write_data;
+static uint8_t* write_address;
+static uint8_t write_left;
+
+static uint8_t checkpoint_checksum(const resume_checkpoint_t* cp)
+{
+    const uint8_t* data = (const uint8_t*)cp;
+    uint8_t sum = 0x5A;
+    for(uint8_t n=0; n<offsetof(resume_checkpoint_t, checksum); n++)
+        sum = ((sum << 1) | (sum >> 7)) ^ data[n];
+    return sum;
+}
+
+static void start_write(uint8_t* address, const void* data, uint8_t size)
+{
+    write_address = address;
+    write_data = (const uint8_t*)data;
+    write_left = size;
+}
+
+void power_resume_init()
+{
+    resume_checkpoint_t cp;
+    bool found = false;
+
+    is_printing = false;
+    resume_stage = 0;
+    write_left = 0;
+    next_slot = 0;
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    for(uint8_t n=0; n<POWER_LOSS_CHECKPOINT_SLOTS; n++)
+    {
+        eeprom_read_block(&cp, POWER_RESUME_SLOT(n), sizeof(cp));
+        if (cp.checksum != checkpoint_checksum(&cp))
+            continue;
+        if (found && cp.sequence < checkpoint.sequence)
+            continue;
+        checkpoint = cp;
+        next_slot = (n + 1) % POWER_LOSS_CHECKPOINT_SLOTS;
+        found = true;
+    }
+    eeprom_read_block(&header, POWER_RESUME_HEADER, sizeof(header));
+    resume_found = found && header.magic == POWER_RESUME_MAGIC && checkpoint.sequence >= header.first_sequence;
+    if (resume_found)
+    {
+        SERIAL_ECHO_START;
+        SERIAL_ECHOLNPGM("Print was interrupted, M1000 resumes it");
+    }
+}
+
+void power_resume_tick()
+{
+    if (is_printing && !card.isFileOpen())
+    {
+        //Finished or aborted, nothing to resume.
+        is_printing = false;
+        write_left = 0;
+        eeprom_write_word((uint16_t*)(POWER_RESUME_EEPROM_OFFSET + offsetof(resume_header_t, magic)), 0);
+        return;
+    }
+    if (write_left > 0)
+    {
+        if (eeprom_is_ready())
+        {
+            eeprom_write_byte(write_address++, *write_data++);
+            write_left--;
+        }
+        return;
+    }
+    if (!is_printing)
+    {
+        if (!card.sdprinting)
+            return;
+        is_printing = true;
+        resume_found = false;
+        header.first_sequence = checkpoint.sequence + 1;
+        header.dir_block = card.getFileDirBlock();
+        header.dir_index = card.getFileDirIndex();
+        header.file_size = card.getFileSize();
+        header.magic = POWER_RESUME_MAGIC;
+        start_write(POWER_RESUME_HEADER, &header, sizeof(header));
+        checkpoint_millis = millis();
+        return;
+    }
+    if (!card.sdprinting || millis() - checkpoint_millis < MILLIS_CHECKPOINT)
+        return;
+    float position[NUM_AXIS];
+    uint32_t file_pos;
+    if (!plan_get_resume_point(&file_pos, position))
+    {
+        //In the middle of an arc, try again a second later.
+        checkpoint_millis = millis() - MILLIS_CHECKPOINT + 1000;
+        return;
+    }
+    checkpoint_millis = millis();
+    //Waiting or paused, the last checkpoint is still right.
+    if (file_pos == checkpoint.file_pos && checkpoint.sequence >= header.first_sequence)
+        return;
+    uint32_t sequence = checkpoint.sequence + 1;
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    checkpoint.sequence = sequence;
+    checkpoint.file_pos = file_pos;
+    memcpy(checkpoint.position, position, sizeof(position));
+    checkpoint.feedrate = feedrate;
+    for(uint8_t e=0; e<EXTRUDERS; e++)
+        checkpoint.target_temperature[e] = target_temperature[e];
+    checkpoint.target_temperature_bed = target_temperature_bed;
+    checkpoint.fan_speed = fanSpeed;
+    checkpoint.extruder = active_extruder;
+    checkpoint.checksum = checkpoint_checksum(&checkpoint);
+    start_write(POWER_RESUME_SLOT(next_slot), &checkpoint, sizeof(checkpoint));
+    next_slot = (next_slot + 1) % POWER_LOSS_CHECKPOINT_SLOTS;
+}
+
+void power_resume_continue()
+{
+    if (resume_stage == 0)
+    {
+        if (!resume_found)
+        {
+            SERIAL_ECHO_START;
+            SERIAL_ECHOLNPGM("No interrupted print to resume");
+            return;
+        }
+        //The queued commands are dropped when there is no room for them, so check first.
+        uint8_t needed = 2; //G28 and M1000
+        if (checkpoint.target_temperature_bed > 0)
+            needed++;
+        for(uint8_t e=0; e<EXTRUDERS; e++)
+            if (checkpoint.target_temperature[e] > 0)
+                needed++;
+        if (commands_queued() + needed > BUFSIZE)
+        {
+            SERIAL_ERROR_START;
+            SERIAL_ERRORLNPGM("Command buffer full, send M1000 again");
+            return;
+        }
+        //Seek to the checkpoint now, it follows the cluster chain while the printer heats up.
+        if (!card.resumeFile(header.dir_block, header.dir_index, header.file_size, checkpoint.file_pos))
+        {
+            SERIAL_ERROR_START;
+            SERIAL_ERRORLNPGM("Cannot open the interrupted print");
+            return;
+        }
+        //Z is not homed, the bed stays at the height where the print stopped. Lower it first so the nozzle
+        //does not touch the print while X and Y are homed and while it travels back.
+        active_extruder = checkpoint.extruder;
+        current_position[Z_AXIS] = checkpoint.position[Z_AXIS];
+        current_position[E_AXIS] = checkpoint.position[E_AXIS];
+        plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+        current_position[Z_AXIS] = min(checkpoint.position[Z_AXIS] + POWER_LOSS_RESUME_Z_LIFT, Z_MAX_POS);
+        plan_buffer_line(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS], homing_feedrate[Z_AXIS]/60, active_extruder);
+
+        char buffer[20];
+        fanSpeed = checkpoint.fan_speed;
+        enquecommand_P(PSTR("G28 X0 Y0"));
+        if (checkpoint.target_temperature_bed > 0)
+        {
+            sprintf_P(buffer, PSTR("M190 S%i"), checkpoint.target_temperature_bed);
+            enquecommand(buffer);
+        }
+        for(uint8_t e=0; e<EXTRUDERS; e++)
+        {
+            if (checkpoint.target_temperature[e] <= 0)
+                continue;
+            sprintf_P(buffer, PSTR("M109 T%i S%i"), e, checkpoint.target_temperature[e]);
+            enquecommand(buffer);
+        }
+        enquecommand_P(PSTR("M1000"));
+        resume_stage = 1;
+        return;
+    }
+
+    resume_stage = 0;
+    if (!card.isFileOpen())
+        return;
+    //Continue from where the interrupted command started: travel back over the print at the lifted Z, then lower the nozzle onto it.
+    active_extruder = checkpoint.extruder;
+    current_position[X_AXIS] = checkpoint.position[X_AXIS];
+    current_position[Y_AXIS] = checkpoint.position[Y_AXIS];
+    plan_buffer_line(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS], homing_feedrate[X_AXIS]/60, active_extruder);
+    current_position[Z_AXIS] = checkpoint.position[Z_AXIS];
+    plan_buffer_line(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS], homing_feedrate[Z_AXIS]/60, active_extruder);
+    feedrate = checkpoint.feedrate;
+    starttime = millis();
+    resume_found = false;
+    card.startFileprint();
+}
+
+#endif//POWER_LOSS_RESUME
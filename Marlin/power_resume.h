@@ -0,0 +1,17 @@
+#ifndef POWER_RESUME_H
+#define POWER_RESUME_H
+
+#ifdef POWER_LOSS_RESUME
+
+//Look for a print that was interrupted by a power failure, called at startup.
+void power_resume_init();
+
+//Detect the start and end of SD prints and write checkpoints, never waits for the EEPROM.
+void power_resume_tick();
+
+//M1000, the first call heats up and homes X and Y, the second call (queued by the first) continues the print.
+void power_resume_continue();
+
+#endif//POWER_LOSS_RESUME
+
+#endif//POWER_RESUME_H
@@ -29,6 +29,7 @@
 #include "UltiLCD2.h"
 #include "language.h"
 #include "lifetime_stats.h"
+#include "power_resume.h"
 #include "cardreader.h"
 #include "speed_lookuptable.h"
 #if defined(DIGIPOTSS_PIN) && DIGIPOTSS_PIN > -1
@@ -507,10 +508,6 @@ ISR(TIMER1_COMPA_vect)
 
 
     for(int8_t i=0; i < step_loops; i++) { // Take multiple steps per interrupt (For high speed moves)
-      #ifndef AT90USB
-      MSerial.checkRx(); // Check for serial chars.
-      #endif
-
       #ifdef ADVANCE
       counter_e += current_block->steps_e;
       if (counter_e > 0) {
@@ -877,11 +874,15 @@ void st_init()
 // Block until all buffered steps are executed
 void st_synchronize()
 {
+    plan_flush_coalesced();
     while( blocks_queued()) {
     manage_heater();
     manage_inactivity();
     lcd_update();
     lifetime_stats_tick();
+#ifdef POWER_LOSS_RESUME
+    power_resume_tick();
+#endif
   }
 }
 
@@ -924,6 +925,7 @@ void finishAndDisableSteppers()
 
 void quickStop()
 {
+  plan_discard_coalesced();
   DISABLE_STEPPER_DRIVER_INTERRUPT();
   while(blocks_queued())
     plan_discard_current_block();
@@ -0,0 +1,135 @@
+#include "Marlin.h"
+#include "temperature.h"
+#include "temp_log.h"
+
+#ifdef TEMP_LOG
+
+#define MILLIS_SAMPLE (TEMP_LOG_INTERVAL * 1000UL)
+
+static temp_log_sample_t samples[TEMP_LOG_SAMPLES];
+static uint8_t sample_next;
+static uint8_t sample_count;
+static unsigned long sample_millis;
+
+//Sums of the heater powers of every measurement since the last sample, for the average.
+static unsigned long power_sum[EXTRUDERS];
+static unsigned long power_sum_bed;
+static uint16_t power_count;
+
+static uint8_t auto_report_seconds;
+static unsigned long auto_report_millis;
+
+static void print_temperature(const char* name_P, float temperature, float target)
+{
+    serialprintPGM(name_P);
+    SERIAL_PROTOCOL_F(temperature, 1);
+    SERIAL_PROTOCOLPGM(" /");
+    SERIAL_PROTOCOL_F(target, 1);
+}
+
+//Same as the M105 answer, with all hotends when there is more than one.
+static void auto_report()
+{
+    print_temperature(PSTR("T:"), degHotend(active_extruder), degTargetHotend(active_extruder));
+#if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
+    print_temperature(PSTR(" B:"), degBed(), degTargetBed());
+#endif
+#if EXTRUDERS > 1
+    for(uint8_t e=0; e<EXTRUDERS; e++)
+    {
+        SERIAL_PROTOCOLPGM(" T");
+        SERIAL_PROTOCOL(int(e));
+        print_temperature(PSTR(":"), degHotend(e), degTargetHotend(e));
+    }
+#endif
+    SERIAL_PROTOCOLPGM(" @:");
+    SERIAL_PROTOCOL(getHeaterPower(active_extruder));
+    SERIAL_PROTOCOLPGM(" B@:");
+    SERIAL_PROTOCOL(getHeaterPower(-1));
+    SERIAL_PROTOCOLLN("");
+}
+
+void temp_log_tick()
+{
+    for(uint8_t e=0; e<EXTRUDERS; e++)
+        power_sum[e] += getHeaterPower(e);
+    power_sum_bed += getHeaterPower(-1);
+    power_count++;
+
+    if (millis() - sample_millis >= MILLIS_SAMPLE)
+    {
+        sample_millis = millis();
+        temp_log_sample_t* sample = &samples[sample_next];
+        for(uint8_t e=0; e<EXTRUDERS; e++)
+        {
+            sample->temperature[e] = degHotend(e) * 10;
+            sample->power[e] = power_sum[e] / power_count;
+            power_sum[e] = 0;
+        }
+        sample->temperature_bed = degBed() * 10;
+        sample->power_bed = power_sum_bed / power_count;
+        power_sum_bed = 0;
+        power_count = 0;
+        sample_next = (sample_next + 1) % TEMP_LOG_SAMPLES;
+        if (sample_count < TEMP_LOG_SAMPLES)
+            sample_count++;
+    }
+
+    if (auto_report_seconds && millis() - auto_report_millis >= auto_report_seconds * 1000UL)
+    {
+        auto_report_millis = millis();
+        auto_report();
+    }
+}
+
+void temp_log_set_auto_report(uint8_t seconds)
+{
+    auto_report_seconds = seconds;
+    auto_report_millis = millis();
+}
+
+uint8_t temp_log_count()
+{
+    return sample_count;
+}
+
+const temp_log_sample_t* temp_log_sample(uint8_t age)
+{
+    return &samples[(sample_next + TEMP_LOG_SAMPLES - 1 - age) % TEMP_LOG_SAMPLES];
+}
+
+//One line per sample: the age in seconds, then the temperatures and average powers.
+void temp_log_dump()
+{
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPGM("Temperature log, samples:");
+    SERIAL_ECHO(int(sample_count));
+    SERIAL_ECHOPGM(" interval:");
+    SERIAL_ECHO(int(TEMP_LOG_INTERVAL));
+    SERIAL_ECHOLNPGM("s");
+    for(uint8_t age=sample_count; age>0; age--)
+    {
+        const temp_log_sample_t* sample = temp_log_sample(age - 1);
+        SERIAL_PROTOCOL(-long(age - 1) * TEMP_LOG_INTERVAL);
+        for(uint8_t e=0; e<EXTRUDERS; e++)
+        {
+            SERIAL_PROTOCOLPGM(" T");
+            SERIAL_PROTOCOL(int(e));
+            SERIAL_PROTOCOLPGM(":");
+            SERIAL_PROTOCOL_F(sample->temperature[e] / 10.0, 1);
+        }
+        SERIAL_PROTOCOLPGM(" B:");
+        SERIAL_PROTOCOL_F(sample->temperature_bed / 10.0, 1);
+        for(uint8_t e=0; e<EXTRUDERS; e++)
+        {
+            SERIAL_PROTOCOLPGM(" @");
+            SERIAL_PROTOCOL(int(e));
+            SERIAL_PROTOCOLPGM(":");
+            SERIAL_PROTOCOL(int(sample->power[e]));
+        }
+        SERIAL_PROTOCOLPGM(" B@:");
+        SERIAL_PROTOCOLLN(int(sample->power_bed));
+    }
+}
+
+#endif//TEMP_LOG
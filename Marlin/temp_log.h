@@ -0,0 +1,30 @@
+#ifndef TEMP_LOG_H
+#define TEMP_LOG_H
+
+#ifdef TEMP_LOG
+
+//One sample of the log, the powers are the average soft PWM value (0-127) over the interval.
+struct temp_log_sample_t
+{
+    int16_t temperature[EXTRUDERS]; //Tenths of a degree.
+    int16_t temperature_bed;
+    uint8_t power[EXTRUDERS];
+    uint8_t power_bed;
+};
+
+//Called by manage_heater for every new temperature measurement.
+void temp_log_tick();
+
+//M155 S<seconds>, send the temperatures every interval without an M105, 0 stops the reports.
+void temp_log_set_auto_report(uint8_t seconds);
+
+//M156, send all samples of the log, oldest first.
+void temp_log_dump();
+
+//Number of samples in the log, and a sample by age, 0 is the newest.
+uint8_t temp_log_count();
+const temp_log_sample_t* temp_log_sample(uint8_t age);
+
+#endif//TEMP_LOG
+
+#endif//TEMP_LOG_H
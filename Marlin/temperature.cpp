@@ -32,10 +32,12 @@
 #include "Marlin.h"
 #include "ultralcd.h"
 #include "lifetime_stats.h"
+#include "temp_log.h"
 #include "UltiLCD2.h"
 #include "temperature.h"
 #include "watchdog.h"
 #include "Sd2Card.h"
+#include "ConfigurationStore.h"
 
 
 //===========================================================================
@@ -78,35 +80,59 @@ static volatile bool temp_meas_ready = false;
 
 #ifdef PIDTEMP
   //static cannot be external:
-  static float temp_iState[EXTRUDERS] = { 0 };
-  static float temp_dState[EXTRUDERS] = { 0 };
-  static float pTerm[EXTRUDERS];
-  static float iTerm[EXTRUDERS];
-  static float dTerm[EXTRUDERS];
+  //The PID runs in fixed point, temperatures and errors in 1/16 degree, the terms in 1/256 PWM step.
+  static long temp_iState[EXTRUDERS] = { 0 };
+  static long temp_dState[EXTRUDERS] = { 0 };
+  static long pTerm[EXTRUDERS];
+  static long iTerm[EXTRUDERS];
+  static long dTerm[EXTRUDERS];
   //int output;
-  static float pid_error[EXTRUDERS];
-  static float temp_iState_min[EXTRUDERS];
-  static float temp_iState_max[EXTRUDERS];
-  // static float pid_input[EXTRUDERS];
-  // static float pid_output[EXTRUDERS];
+  static long pid_error[EXTRUDERS];
+  static long temp_iState_min[EXTRUDERS];
+  static long temp_iState_max[EXTRUDERS];
   static bool pid_reset[EXTRUDERS];
+  //Kp, Ki and Kd in fixed point, set by updatePID()
+  static long pid_Kp, pid_Ki, pid_Kd;
+  static long pid_error_limit, pid_delta_limit;
+  #ifdef PID_ADD_EXTRUSION_RATE
+  static long cTerm[EXTRUDERS];
+  static long pid_Kc, pid_e_rate_limit;
+  #endif
 #endif //PIDTEMP
 #ifdef PIDTEMPBED
   //static cannot be external:
-  static float temp_iState_bed = { 0 };
-  static float temp_dState_bed = { 0 };
-  static float pTerm_bed;
-  static float iTerm_bed;
-  static float dTerm_bed;
+  static long temp_iState_bed = { 0 };
+  static long temp_dState_bed = { 0 };
+  static long pTerm_bed;
+  static long iTerm_bed;
+  static long dTerm_bed;
   //int output;
-  static float pid_error_bed;
-  static float temp_iState_min_bed;
-  static float temp_iState_max_bed;
+  static long pid_error_bed;
+  static long temp_iState_min_bed;
+  static long temp_iState_max_bed;
+  static long pid_Kp_bed, pid_Ki_bed, pid_Kd_bed;
+  static long pid_error_limit_bed, pid_delta_limit_bed;
 #else //PIDTEMPBED
 	static unsigned long  previous_millis_bed_heater;
 #endif //PIDTEMPBED
-  static unsigned char soft_pwm[EXTRUDERS];
-  static unsigned char soft_pwm_bed;
+#ifdef HEATER_SIGMA_DELTA
+  //soft_pwm is the PID output (0-255) with 4 fraction bits, the heater is on for soft_pwm of every SOFT_PWM_ONE Timer0 ticks.
+  #define SOFT_PWM_FRACTION_BITS 4
+  #define SOFT_PWM_ONE (256 << SOFT_PWM_FRACTION_BITS)
+  #define SOFT_PWM(output) (output)
+  #define SOFT_PWM_POWER(pwm) ((pwm) >> (SOFT_PWM_FRACTION_BITS + 1))
+  typedef uint16_t soft_pwm_t;
+#else
+  //soft_pwm is the PID output (0-255) halved, the heater is on for soft_pwm of the 128 ticks of the PWM period.
+  #define SOFT_PWM_FRACTION_BITS 0
+  #define SOFT_PWM(output) ((output) >> 1)
+  #define SOFT_PWM_POWER(pwm) (pwm)
+  typedef unsigned char soft_pwm_t;
+#endif
+  //Power from 0 to 255 in the soft_pwm format, the PID output keeps SOFT_PWM_FRACTION_BITS more bits.
+  #define PID_TO_SOFT_PWM(power) SOFT_PWM((power) << SOFT_PWM_FRACTION_BITS)
+  static soft_pwm_t soft_pwm[EXTRUDERS];
+  static soft_pwm_t soft_pwm_bed;
 #ifdef FAN_SOFT_PWM
   static unsigned char soft_pwm_fan;
 #endif
@@ -143,6 +169,7 @@ static float max_heating_start_temperature[EXTRUDERS];
 
 static float analog2temp(int raw, uint8_t e);
 static float analog2tempBed(int raw);
+static int analog_limit(int raw, int step, int limit, bool isMin, uint8_t e);
 static void updateTemperaturesFromRawValues();
 
 #ifdef WATCH_TEMP_PERIOD
@@ -157,28 +184,89 @@ unsigned long watchmillis[EXTRUDERS] = ARRAY_BY_EXTRUDERS(0,0,0);
 #ifdef HEATER_0_USES_MAX6675
 static int read_max6675();
 #endif
+static void adc_start();
 //===========================================================================
 //=============================   functions      ============================
 //===========================================================================
 
-void PID_autotune(float temp, int extruder, int ncycles)
+//The autotune fits a first order plus dead time model of the heater: gain K (degrees per PWM step), time constant T and dead time L (seconds).
+//While heating up at constant power P the rise slows down linearly with the temperature: slope = (K*P - (temp - ambient)) / T.
+//A line fitted through the slope against the temperature gives T, and with the relay bias that holds the target temperature, K.
+//At the period Tu of the relay oscillation the loop phase is -180 degrees: wL + atan(wT) = pi, which gives L.
+static bool PID_autotune_fit(float Tu, float T, float K, float& Kp, float& Ki, float& Kd)
+{
+  if (!(T > 0) || !(K > 0))
+    return false;
+  float w = 2.0 * M_PI / Tu;
+  float L = (M_PI - atan(w * T)) / w;
+  SERIAL_PROTOCOLPGM(" Model K: "); SERIAL_PROTOCOL(K);
+  SERIAL_PROTOCOLPGM(" T: "); SERIAL_PROTOCOL(T);
+  SERIAL_PROTOCOLPGM(" L: "); SERIAL_PROTOCOLLN(L);
+
+  //SIMC rules with a closed loop time constant of L/2 and L/2 of derivative time, which keeps the overshoot of a heat up
+  //small. They give the PID in series form, convert it to the parallel form used by manage_heater().
+  float Kp_series = (T + L / 2.0) / (K * 1.5 * L);
+  float Ti_series = min(T + L / 2.0, 6.0 * L);
+  float Td_series = L / 2.0;
+  float f = 1.0 + Td_series / Ti_series;
+  Kp = Kp_series * f;
+  Ki = Kp / (Ti_series * f);
+  Kd = Kp * Td_series / f;
+  return true;
+}
+
+#ifdef PID_ADD_EXTRUSION_RATE
+//Keep a second of extrusion queued, called from the autotune loop which does not process commands.
+static void autotune_extrude(int extruder, float e_speed)
+{
+  if (movesplanned() >= 2)
+    return;
+  current_position[E_AXIS] += e_speed / volume_to_filament_length[extruder];
+  plan_buffer_line(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS], e_speed, extruder);
+}
+#endif
+
+void PID_autotune(float temp, int extruder, int ncycles, float e_speed)
 {
   float input = 0.0;
   int cycles=0;
   bool heating = true;
+  bool finished = false;
 
   unsigned long temp_millis = millis();
+  unsigned long start_millis = temp_millis;
   unsigned long t1=temp_millis;
   unsigned long t2=temp_millis;
   long t_high = 0;
   long t_low = 0;
 
-  long bias, d;
+  long bias, d, heatup_power, idle_bias;
   float Ku, Tu;
   float Kp, Ki, Kd;
   float max = 0, min = 10000;
+  //Relay results, averaged over the cycles after the bias has settled.
+  float Tu_sum = 0;
+  int fit_cycles = 0;
+  //Temperature rise during the heat up, measured over each second. The line is fitted from the fastest rise on,
+  //before that the heater is still in its dead time.
+  bool heatup = true;
+  float max_slope = 0;
+  float slope_temp = 0;
+  unsigned long slope_millis = 0;
+  float fit_n = 0, fit_t = 0, fit_s = 0, fit_tt = 0, fit_ts = 0;
+#ifdef PID_ADD_EXTRUSION_RATE
+  //With an extrusion speed, the relay runs ncycles more while extruding. The extra heater power it settles at gives Kc.
+  bool extruding = false;
+  float e_start = current_position[E_AXIS];
+  if (e_speed > 0 && extruder != active_extruder)
+  {
+    SERIAL_ECHOLNPGM("PID Autotune can only extrude with the active extruder.");
+    e_speed = 0;
+  }
+  plan_flush_coalesced();
+#endif
 
-  if ((extruder > EXTRUDERS)
+  if ((extruder >= EXTRUDERS)
   #if (TEMP_BED_PIN <= -1)
        ||(extruder < 0)
   #endif
@@ -186,6 +274,9 @@ void PID_autotune(float temp, int extruder, int ncycles)
           SERIAL_ECHOLNPGM("PID Autotune failed. Bad extruder number.");
           return;
         }
+  //The model is fitted on the cycles after the second one.
+  if (ncycles < 3)
+    ncycles = 3;
 
   SERIAL_ECHOLNPGM("PID Autotune start");
 
@@ -193,37 +284,63 @@ void PID_autotune(float temp, int extruder, int ncycles)
 
   if (extruder<0)
   {
-     soft_pwm_bed = (MAX_BED_POWER)/2;
+     soft_pwm_bed = PID_TO_SOFT_PWM((MAX_BED_POWER)/2);
      bias = d = (MAX_BED_POWER)/2;
    }
    else
    {
-     soft_pwm[extruder] = (PID_MAX)/2;
+     soft_pwm[extruder] = PID_TO_SOFT_PWM((PID_MAX)/2);
      bias = d = (PID_MAX)/2;
   }
-
-
-
+  heatup_power = bias + d;
 
  for(;;) {
 
     if(temp_meas_ready == true) { // temp sample ready
       updateTemperaturesFromRawValues();
+      #ifdef TEMP_LOG
+      temp_log_tick();
+      #endif
 
       input = (extruder<0)?current_temperature_bed:current_temperature[extruder];
 
       max=max(max,input);
       min=min(min,input);
+      if(heatup) {
+        if (slope_millis == 0) {
+          slope_temp = input;
+          slope_millis = millis();
+        }else if (millis() - slope_millis >= 1000) {
+          float slope = (input - slope_temp) * 1000.0 / (millis() - slope_millis);
+          float t = (input + slope_temp) / 2.0;
+          if (slope > max_slope) {
+            max_slope = slope;
+            fit_n = fit_t = fit_s = fit_tt = fit_ts = 0;
+          }
+          fit_n += 1;
+          fit_t += t;
+          fit_s += slope;
+          fit_tt += t * t;
+          fit_ts += t * slope;
+          slope_temp = input;
+          slope_millis = millis();
+        }
+      }
       if(heating == true && input > temp) {
         if(millis() - t2 > 5000) {
           heating=false;
           if (extruder<0)
-            soft_pwm_bed = (bias - d) >> 1;
+            soft_pwm_bed = PID_TO_SOFT_PWM(bias - d);
           else
-            soft_pwm[extruder] = (bias - d) >> 1;
+            soft_pwm[extruder] = PID_TO_SOFT_PWM(bias - d);
           t1=millis();
           t_high=t1 - t2;
           max=temp;
+          if (heatup) {
+            heatup = false;
+            SERIAL_PROTOCOLPGM(" heat up: "); SERIAL_PROTOCOL((t1 - start_millis) / 1000);
+            SERIAL_PROTOCOLPGM("s max rise: "); SERIAL_PROTOCOLLN(max_slope);
+          }
         }
       }
       if(heating == false && input < temp) {
@@ -241,40 +358,23 @@ void PID_autotune(float temp, int extruder, int ncycles)
             SERIAL_PROTOCOLPGM(" d: "); SERIAL_PROTOCOL(d);
             SERIAL_PROTOCOLPGM(" min: "); SERIAL_PROTOCOL(min);
             SERIAL_PROTOCOLPGM(" max: "); SERIAL_PROTOCOLLN(max);
-            if(cycles > 2) {
+            if(cycles > 2
+#ifdef PID_ADD_EXTRUSION_RATE
+                && !extruding
+#endif
+                ) {
               Ku = (4.0*d)/(3.14159*(max-min)/2.0);
               Tu = ((float)(t_low + t_high)/1000.0);
               SERIAL_PROTOCOLPGM(" Ku: "); SERIAL_PROTOCOL(Ku);
               SERIAL_PROTOCOLPGM(" Tu: "); SERIAL_PROTOCOLLN(Tu);
-              Kp = 0.6*Ku;
-              Ki = 2*Kp/Tu;
-              Kd = Kp*Tu/8;
-              SERIAL_PROTOCOLLNPGM(" Clasic PID ");
-              SERIAL_PROTOCOLPGM(" Kp: "); SERIAL_PROTOCOLLN(Kp);
-              SERIAL_PROTOCOLPGM(" Ki: "); SERIAL_PROTOCOLLN(Ki);
-              SERIAL_PROTOCOLPGM(" Kd: "); SERIAL_PROTOCOLLN(Kd);
-              /*
-              Kp = 0.33*Ku;
-              Ki = Kp/Tu;
-              Kd = Kp*Tu/3;
-              SERIAL_PROTOCOLLNPGM(" Some overshoot ")
-              SERIAL_PROTOCOLPGM(" Kp: "); SERIAL_PROTOCOLLN(Kp);
-              SERIAL_PROTOCOLPGM(" Ki: "); SERIAL_PROTOCOLLN(Ki);
-              SERIAL_PROTOCOLPGM(" Kd: "); SERIAL_PROTOCOLLN(Kd);
-              Kp = 0.2*Ku;
-              Ki = 2*Kp/Tu;
-              Kd = Kp*Tu/3;
-              SERIAL_PROTOCOLLNPGM(" No overshoot ")
-              SERIAL_PROTOCOLPGM(" Kp: "); SERIAL_PROTOCOLLN(Kp);
-              SERIAL_PROTOCOLPGM(" Ki: "); SERIAL_PROTOCOLLN(Ki);
-              SERIAL_PROTOCOLPGM(" Kd: "); SERIAL_PROTOCOLLN(Kd);
-              */
+              Tu_sum += Tu;
+              fit_cycles++;
             }
           }
           if (extruder<0)
-            soft_pwm_bed = (bias + d) >> 1;
+            soft_pwm_bed = PID_TO_SOFT_PWM(bias + d);
           else
-            soft_pwm[extruder] = (bias + d) >> 1;
+            soft_pwm[extruder] = PID_TO_SOFT_PWM(bias + d);
           cycles++;
           min=temp;
         }
@@ -282,15 +382,15 @@ void PID_autotune(float temp, int extruder, int ncycles)
     }
     if(input > (temp + 20)) {
       SERIAL_PROTOCOLLNPGM("PID Autotune failed! Temperature too high");
-      return;
+      break;
     }
     if(millis() - temp_millis > 2000) {
       int p;
       if (extruder<0){
-        p=soft_pwm_bed;
+        p=SOFT_PWM_POWER(soft_pwm_bed);
         SERIAL_PROTOCOLPGM("ok B:");
       }else{
-        p=soft_pwm[extruder];
+        p=SOFT_PWM_POWER(soft_pwm[extruder]);
         SERIAL_PROTOCOLPGM("ok T:");
       }
 
@@ -302,33 +402,177 @@ void PID_autotune(float temp, int extruder, int ncycles)
     }
     if(((millis() - t1) + (millis() - t2)) > (10L*60L*1000L*2L)) {
       SERIAL_PROTOCOLLNPGM("PID Autotune failed! timeout");
-      return;
+      break;
     }
     if(cycles > ncycles) {
-      SERIAL_PROTOCOLLNPGM("PID Autotune finished! Put the Kp, Ki and Kd constants into Configuration.h");
-      return;
+#ifdef PID_ADD_EXTRUSION_RATE
+      if (e_speed > 0 && !extruding)
+      {
+        SERIAL_PROTOCOLLNPGM("PID Autotune extruding");
+        extruding = true;
+        idle_bias = bias;
+        cycles = 0;
+      }else
+#endif
+      {
+        finished = true;
+        break;
+      }
     }
+#ifdef PID_ADD_EXTRUSION_RATE
+    if (extruding)
+      autotune_extrude(extruder, e_speed);
+#endif
     lcd_update();
     lifetime_stats_tick();
   }
+#ifdef PID_ADD_EXTRUSION_RATE
+  if (extruding)
+  {
+    //Drop the rest of the extrusion, the E position is left where it was before the autotune.
+    quickStop();
+    current_position[E_AXIS] = e_start;
+    plan_set_e_position(current_position[E_AXIS]);
+  }
+#endif
+  if (!finished)
+    return;
+#ifdef PID_ADD_EXTRUSION_RATE
+  if (!extruding)
+#endif
+    idle_bias = bias;
+
+  Tu = Tu_sum / fit_cycles;
+  //Line through the heat up: slope = a + b * temperature, with b = -1/T. At the target temperature the heater
+  //power that is left above the relay bias still raises the temperature by the slope there: K * (P - bias) / T.
+  float b = (fit_n * fit_ts - fit_t * fit_s) / (fit_n * fit_tt - fit_t * fit_t);
+  float T = -1.0 / b;
+  float K = T * ((fit_s - b * fit_t) / fit_n + b * temp) / (heatup_power - idle_bias);
+  if (fit_n < 3 || !PID_autotune_fit(Tu, T, K, Kp, Ki, Kd))
+  {
+    //No usable heat up, for example when the heater was already close to the target. Fall back on the classic rules for the relay test.
+    SERIAL_PROTOCOLLNPGM(" No model fit, classic PID");
+    Kp = 0.6*Ku;
+    Ki = 2*Kp/Tu;
+    Kd = Kp*Tu/8;
+  }
+  SERIAL_PROTOCOLPGM(" Kp: "); SERIAL_PROTOCOLLN(Kp);
+  SERIAL_PROTOCOLPGM(" Ki: "); SERIAL_PROTOCOLLN(Ki);
+  SERIAL_PROTOCOLPGM(" Kd: "); SERIAL_PROTOCOLLN(Kd);
+
+  if (extruder<0)
+  {
+#ifdef PIDTEMPBED
+    bedKp = Kp;
+    bedKi = scalePID_i(Ki);
+    bedKd = scalePID_d(Kd);
+#else
+    SERIAL_PROTOCOLLNPGM("PID Autotune finished! The bed does not use PID, nothing stored");
+    return;
+#endif
+  }else{
+#ifdef PIDTEMP
+    ::Kp = Kp;
+    ::Ki = scalePID_i(Ki);
+    ::Kd = scalePID_d(Kd);
+#ifdef PID_ADD_EXTRUSION_RATE
+    if (extruding)
+    {
+      Kc = (bias - idle_bias) / e_speed;
+      SERIAL_PROTOCOLPGM(" Kc: "); SERIAL_PROTOCOLLN(Kc);
+    }
+#endif
+#else
+    SERIAL_PROTOCOLLNPGM("PID Autotune finished! The hotend does not use PID, nothing stored");
+    return;
+#endif
+  }
+  updatePID();
+  Config_StoreSettings();
+  SERIAL_PROTOCOLLNPGM("PID Autotune finished! The new settings are stored");
 }
 
+#if defined(PIDTEMP) || defined(PIDTEMPBED)
+//Fixed point formats of the PID: Kp and Kd have 12 fraction bits, Ki has 16.
+//Temperatures, errors and the integral state have 4 fraction bits, the P, I and D terms have 8.
+#define PID_GAIN_SHIFT 12
+#define PID_KI_SHIFT 16
+#define PID_TEMP_SHIFT 4
+#define PID_OUTPUT_SHIFT 8
+//1-K1 with 16 fraction bits, the D term moves this part of the way to the new value each sample.
+#define PID_K2_FIXED ((uint16_t)((1.0-K1) * 65536.0 + 0.5))
+
+static long pid_fixed_gain(float gain, uint8_t shift)
+{
+  gain *= (float)(1L << shift);
+  if (gain <= 0)
+    return 0;
+  if (gain >= 2147483647.0)
+    return 0x7FFFFFFF;
+  return (long)(gain + 0.5);
+}
+
+//Largest value that can be multiplied with the gain without overflowing.
+static long pid_value_limit(long gain)
+{
+  if (gain == 0)
+    return 0x7FFFFFFF;
+  return 0x7FFFFFFF / gain;
+}
+
+//P and D terms: a gain with 12 fraction bits times a temperature with 4, limited so the product fits.
+//The limit is only reached on errors beyond any heater range or on sensor jumps, where the output is at its limit anyway.
+static inline long pid_term(long gain, long value, long limit)
+{
+  return (gain * constrain(value, -limit, limit)) >> (PID_GAIN_SHIFT + PID_TEMP_SHIFT - PID_OUTPUT_SHIFT);
+}
+
+//dTerm + (value - dTerm) * (1-K1), which is (1-K1) * value + K1 * dTerm as before. The 16 bit fraction is split off so nothing overflows.
+static inline long pid_filter(long dTerm, long value)
+{
+  long a = value - dTerm;
+  return dTerm + (a >> 16) * PID_K2_FIXED + (long)(((unsigned long)(a & 0xFFFF) * PID_K2_FIXED) >> 16);
+}
+
+//Anti-windup: the integral state at which the I term reaches PID_INTEGRAL_DRIVE_MAX.
+static long pid_iState_limit(long Ki)
+{
+  if (Ki == 0)
+    return 0;
+  return ((long)PID_INTEGRAL_DRIVE_MAX << (PID_KI_SHIFT + PID_TEMP_SHIFT)) / Ki;
+}
+#endif
+
 void updatePID()
 {
 #ifdef PIDTEMP
+  pid_Kp = pid_fixed_gain(Kp, PID_GAIN_SHIFT);
+  pid_Ki = pid_fixed_gain(Ki, PID_KI_SHIFT);
+  pid_Kd = pid_fixed_gain(Kd, PID_GAIN_SHIFT);
+  pid_error_limit = pid_value_limit(pid_Kp);
+  pid_delta_limit = pid_value_limit(pid_Kd);
+  #ifdef PID_ADD_EXTRUSION_RATE
+  pid_Kc = pid_fixed_gain(Kc, PID_OUTPUT_SHIFT);
+  pid_e_rate_limit = pid_value_limit(pid_Kc);
+  #endif
   for(int e = 0; e < EXTRUDERS; e++) {
-     temp_iState_max[e] = PID_INTEGRAL_DRIVE_MAX / Ki;
+     temp_iState_max[e] = pid_iState_limit(pid_Ki);
   }
 #endif
 #ifdef PIDTEMPBED
-  temp_iState_max_bed = PID_INTEGRAL_DRIVE_MAX / bedKi;
+  pid_Kp_bed = pid_fixed_gain(bedKp, PID_GAIN_SHIFT);
+  pid_Ki_bed = pid_fixed_gain(bedKi, PID_KI_SHIFT);
+  pid_Kd_bed = pid_fixed_gain(bedKd, PID_GAIN_SHIFT);
+  pid_error_limit_bed = pid_value_limit(pid_Kp_bed);
+  pid_delta_limit_bed = pid_value_limit(pid_Kd_bed);
+  temp_iState_max_bed = pid_iState_limit(pid_Ki_bed);
 #endif
 }
 
 int getHeaterPower(int heater) {
 	if (heater<0)
-		return soft_pwm_bed;
-  return soft_pwm[heater];
+		return SOFT_PWM_POWER(soft_pwm_bed);
+  return SOFT_PWM_POWER(soft_pwm[heater]);
 }
 
 #if (defined(EXTRUDER_0_AUTO_FAN_PIN) && EXTRUDER_0_AUTO_FAN_PIN > -1) || \
@@ -405,13 +649,16 @@ void checkExtruderAutoFans()
 
 void manage_heater()
 {
-  float pid_input;
-  float pid_output;
+  long pid_input;
+  int pid_output;
 
   if(temp_meas_ready != true)   //better readability
     return;
 
   updateTemperaturesFromRawValues();
+  #ifdef TEMP_LOG
+  temp_log_tick();
+  #endif
 
   #ifdef HEATER_0_USES_MAX6675
   if (current_temperature[0] > 1023 || current_temperature[0] > HEATER_0_MAXTEMP)
@@ -427,63 +674,75 @@ void manage_heater()
   {
 
   #ifdef PIDTEMP
-    pid_input = current_temperature[e];
+    pid_input = (long)(current_temperature[e] * (1 << PID_TEMP_SHIFT));
 
     #ifndef PID_OPENLOOP
-        pid_error[e] = target_temperature[e] - pid_input;
-        if(pid_error[e] > PID_FUNCTIONAL_RANGE) {
-          pid_output = BANG_MAX;
+        pid_error[e] = ((long)target_temperature[e] << PID_TEMP_SHIFT) - pid_input;
+        if(pid_error[e] > ((long)PID_FUNCTIONAL_RANGE << PID_TEMP_SHIFT)) {
+          pid_output = BANG_MAX << SOFT_PWM_FRACTION_BITS;
           pid_reset[e] = true;
         }
-        else if(pid_error[e] < -PID_FUNCTIONAL_RANGE || target_temperature[e] == 0) {
+        else if(pid_error[e] < -((long)PID_FUNCTIONAL_RANGE << PID_TEMP_SHIFT) || target_temperature[e] == 0) {
           pid_output = 0;
           pid_reset[e] = true;
         }
         else {
           if(pid_reset[e] == true) {
-            temp_iState[e] = 0.0;
+            temp_iState[e] = 0;
             pid_reset[e] = false;
           }
-          pTerm[e] = Kp * pid_error[e];
+          pTerm[e] = pid_term(pid_Kp, pid_error[e], pid_error_limit);
           temp_iState[e] += pid_error[e];
           temp_iState[e] = constrain(temp_iState[e], temp_iState_min[e], temp_iState_max[e]);
-          iTerm[e] = Ki * temp_iState[e];
+          iTerm[e] = (pid_Ki * temp_iState[e]) >> (PID_KI_SHIFT + PID_TEMP_SHIFT - PID_OUTPUT_SHIFT);
 
           //K1 defined in Configuration.h in the PID settings
-          #define K2 (1.0-K1)
-          dTerm[e] = (Kd * (pid_input - temp_dState[e]))*K2 + (K1 * dTerm[e]);
-          pid_output = constrain(pTerm[e] + iTerm[e] - dTerm[e], 0, PID_MAX);
+          dTerm[e] = pid_filter(dTerm[e], pid_term(pid_Kd, pid_input - temp_dState[e], pid_delta_limit));
+          #ifdef PID_ADD_EXTRUSION_RATE
+          //Feed forward the heat the filament takes away, from the extrusion speed PID_EXTRUSION_RATE_LOOKAHEAD from now.
+          //The heater then warms up before the flow increases, instead of after the nozzle has cooled down.
+          cTerm[e] = (pid_Kc * min((long)plan_get_e_rate_ahead(e, PID_EXTRUSION_RATE_LOOKAHEAD), pid_e_rate_limit)) >> PLAN_E_RATE_SHIFT;
+          pid_output = constrain(pTerm[e] + iTerm[e] - dTerm[e] + cTerm[e], 0, (long)PID_MAX << PID_OUTPUT_SHIFT) >> (PID_OUTPUT_SHIFT - SOFT_PWM_FRACTION_BITS);
+          #else
+          pid_output = constrain(pTerm[e] + iTerm[e] - dTerm[e], 0, (long)PID_MAX << PID_OUTPUT_SHIFT) >> (PID_OUTPUT_SHIFT - SOFT_PWM_FRACTION_BITS);
+          #endif
         }
         temp_dState[e] = pid_input;
     #else
-          pid_output = constrain(target_temperature[e], 0, PID_MAX);
+          pid_output = constrain(target_temperature[e], 0, PID_MAX) << SOFT_PWM_FRACTION_BITS;
     #endif //PID_OPENLOOP
     #ifdef PID_DEBUG
     SERIAL_ECHO_START;
     SERIAL_ECHOPGM(" PIDDEBUG ");
     SERIAL_ECHO(e);
     SERIAL_ECHOPGM(": Input ");
-    SERIAL_ECHO(pid_input);
+    SERIAL_ECHO(current_temperature[e]);
     SERIAL_ECHOPGM(" Output ");
-    SERIAL_ECHO(pid_output);
+    SERIAL_ECHO(pid_output >> SOFT_PWM_FRACTION_BITS);
     SERIAL_ECHOPGM(" pTerm ");
-    SERIAL_ECHO(pTerm[e]);
+    SERIAL_ECHO(pTerm[e] >> PID_OUTPUT_SHIFT);
     SERIAL_ECHOPGM(" iTerm ");
-    SERIAL_ECHO(iTerm[e]);
+    SERIAL_ECHO(iTerm[e] >> PID_OUTPUT_SHIFT);
     SERIAL_ECHOPGM(" dTerm ");
-    SERIAL_ECHOLN(dTerm[e]);
+    #ifdef PID_ADD_EXTRUSION_RATE
+    SERIAL_ECHO(dTerm[e] >> PID_OUTPUT_SHIFT);
+    SERIAL_ECHOPGM(" cTerm ");
+    SERIAL_ECHOLN(cTerm[e] >> PID_OUTPUT_SHIFT);
+    #else
+    SERIAL_ECHOLN(dTerm[e] >> PID_OUTPUT_SHIFT);
+    #endif
     #endif //PID_DEBUG
   #else /* PID off */
     pid_output = 0;
     if(current_temperature[e] < target_temperature[e]) {
-      pid_output = PID_MAX;
+      pid_output = PID_MAX << SOFT_PWM_FRACTION_BITS;
     }
   #endif
 
     // Check if temperature is within the correct range
     if((current_temperature[e] > minttemp[e]) && (current_temperature[e] < maxttemp[e]))
     {
-      soft_pwm[e] = (int)pid_output >> 1;
+      soft_pwm[e] = SOFT_PWM(pid_output);
     }
     else {
       soft_pwm[e] = 0;
@@ -516,7 +775,7 @@ void manage_heater()
         #endif
       }
     #endif
-    if (soft_pwm[e] == (PID_MAX >> 1))
+    if (soft_pwm[e] == PID_TO_SOFT_PWM(PID_MAX))
     {
         if (current_temperature[e] - max_heating_start_temperature[e] > MAX_HEATING_TEMPERATURE_INCREASE)
         {
@@ -576,29 +835,28 @@ void manage_heater()
   #if TEMP_SENSOR_BED != 0
 
   #ifdef PIDTEMPBED
-    pid_input = current_temperature_bed;
+    pid_input = (long)(current_temperature_bed * (1 << PID_TEMP_SHIFT));
 
     #ifndef PID_OPENLOOP
-		  pid_error_bed = target_temperature_bed - pid_input;
-		  pTerm_bed = bedKp * pid_error_bed;
+		  pid_error_bed = ((long)target_temperature_bed << PID_TEMP_SHIFT) - pid_input;
+		  pTerm_bed = pid_term(pid_Kp_bed, pid_error_bed, pid_error_limit_bed);
 		  temp_iState_bed += pid_error_bed;
 		  temp_iState_bed = constrain(temp_iState_bed, temp_iState_min_bed, temp_iState_max_bed);
-		  iTerm_bed = bedKi * temp_iState_bed;
+		  iTerm_bed = (pid_Ki_bed * temp_iState_bed) >> (PID_KI_SHIFT + PID_TEMP_SHIFT - PID_OUTPUT_SHIFT);
 
 		  //K1 defined in Configuration.h in the PID settings
-		  #define K2 (1.0-K1)
-		  dTerm_bed= (bedKd * (pid_input - temp_dState_bed))*K2 + (K1 * dTerm_bed);
+		  dTerm_bed = pid_filter(dTerm_bed, pid_term(pid_Kd_bed, pid_input - temp_dState_bed, pid_delta_limit_bed));
 		  temp_dState_bed = pid_input;
 
-		  pid_output = constrain(pTerm_bed + iTerm_bed - dTerm_bed, 0, MAX_BED_POWER);
+		  pid_output = constrain(pTerm_bed + iTerm_bed - dTerm_bed, 0, (long)MAX_BED_POWER << PID_OUTPUT_SHIFT) >> (PID_OUTPUT_SHIFT - SOFT_PWM_FRACTION_BITS);
 
     #else
-      pid_output = constrain(target_temperature_bed, 0, MAX_BED_POWER);
+      pid_output = constrain(target_temperature_bed, 0, MAX_BED_POWER) << SOFT_PWM_FRACTION_BITS;
     #endif //PID_OPENLOOP
 
 	  if((current_temperature_bed > BED_MINTEMP) && (current_temperature_bed < BED_MAXTEMP))
 	  {
-	    soft_pwm_bed = (int)pid_output >> 1;
+	    soft_pwm_bed = SOFT_PWM(pid_output);
 	  }
 	  else {
 	    soft_pwm_bed = 0;
@@ -614,7 +872,7 @@ void manage_heater()
         }
         else
         {
-          soft_pwm_bed = MAX_BED_POWER>>1;
+          soft_pwm_bed = PID_TO_SOFT_PWM(MAX_BED_POWER);
         }
       }
       else
@@ -632,7 +890,7 @@ void manage_heater()
         }
         else if(current_temperature_bed <= target_temperature_bed - BED_HYSTERESIS)
         {
-          soft_pwm_bed = MAX_BED_POWER>>1;
+          soft_pwm_bed = PID_TO_SOFT_PWM(MAX_BED_POWER);
         }
       }
       else
@@ -645,6 +903,28 @@ void manage_heater()
 }
 
 #define PGM_RD_W(x)   (short)pgm_read_word(&x)
+// Binary search for the first table entry above raw and interpolate from the entry before it in 1/256 degree fixed point.
+// Same result as scanning the table: below the first entry it extrapolates, past the last entry it gives the last temperature.
+static float analog2tempTable(const short (*tt)[2], uint8_t len, int raw)
+{
+  uint8_t lo = 1, hi = len;
+  while (lo < hi)
+  {
+    uint8_t mid = (lo + hi) / 2;
+    if (PGM_RD_W(tt[mid][0]) > raw)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  if (lo == len)
+    return PGM_RD_W(tt[len-1][1]);
+
+  short raw0 = PGM_RD_W(tt[lo-1][0]);
+  short celsius0 = PGM_RD_W(tt[lo-1][1]);
+  long frac = (long)(raw - raw0) * (PGM_RD_W(tt[lo][1]) - celsius0) * 256 / (PGM_RD_W(tt[lo][0]) - raw0);
+  return celsius0 + frac * (1.0 / 256.0);
+}
+
 // Derived from RepRap FiveD extruder::getTemperature()
 // For hot end temperature measurement.
 static float analog2temp(int raw, uint8_t e) {
@@ -667,28 +947,7 @@ static float analog2temp(int raw, uint8_t e) {
   #endif
 
   if(heater_ttbl_map[e] != NULL)
-  {
-    float celsius = 0;
-    uint8_t i;
-    short (*tt)[][2] = (short (*)[][2])(heater_ttbl_map[e]);
-
-    for (i=1; i<heater_ttbllen_map[e]; i++)
-    {
-      if (PGM_RD_W((*tt)[i][0]) > raw)
-      {
-        celsius = PGM_RD_W((*tt)[i-1][1]) +
-          (raw - PGM_RD_W((*tt)[i-1][0])) *
-          (float)(PGM_RD_W((*tt)[i][1]) - PGM_RD_W((*tt)[i-1][1])) /
-          (float)(PGM_RD_W((*tt)[i][0]) - PGM_RD_W((*tt)[i-1][0]));
-        break;
-      }
-    }
-
-    // Overflow: Set to last value in the table
-    if (i == heater_ttbllen_map[e]) celsius = PGM_RD_W((*tt)[i-1][1]);
-
-    return celsius;
-  }
+    return analog2tempTable((const short (*)[2])heater_ttbl_map[e], heater_ttbllen_map[e], raw);
   return ((raw * ((5.0 * 100.0) / 1024.0) / OVERSAMPLENR) * TEMP_SENSOR_AD595_GAIN) + TEMP_SENSOR_AD595_OFFSET;
 }
 
@@ -696,25 +955,7 @@ static float analog2temp(int raw, uint8_t e) {
 // For bed temperature measurement.
 static float analog2tempBed(int raw) {
   #ifdef BED_USES_THERMISTOR
-    float celsius = 0;
-    byte i;
-
-    for (i=1; i<BEDTEMPTABLE_LEN; i++)
-    {
-      if (PGM_RD_W(BEDTEMPTABLE[i][0]) > raw)
-      {
-        celsius  = PGM_RD_W(BEDTEMPTABLE[i-1][1]) +
-          (raw - PGM_RD_W(BEDTEMPTABLE[i-1][0])) *
-          (float)(PGM_RD_W(BEDTEMPTABLE[i][1]) - PGM_RD_W(BEDTEMPTABLE[i-1][1])) /
-          (float)(PGM_RD_W(BEDTEMPTABLE[i][0]) - PGM_RD_W(BEDTEMPTABLE[i-1][0]));
-        break;
-      }
-    }
-
-    // Overflow: Set to last value in the table
-    if (i == BEDTEMPTABLE_LEN) celsius = PGM_RD_W(BEDTEMPTABLE[i-1][1]);
-
-    return celsius;
+    return analog2tempTable(BEDTEMPTABLE, BEDTEMPTABLE_LEN, raw);
   #elif defined BED_USES_AD595
     return ((raw * ((5.0 * 100.0) / 1024.0) / OVERSAMPLENR) * TEMP_SENSOR_AD595_GAIN) + TEMP_SENSOR_AD595_OFFSET;
   #else
@@ -759,12 +1000,10 @@ void tp_init()
     // populate with the first value
     maxttemp[e] = maxttemp[0];
 #ifdef PIDTEMP
-    temp_iState_min[e] = 0.0;
-    temp_iState_max[e] = PID_INTEGRAL_DRIVE_MAX / Ki;
+    temp_iState_min[e] = 0;
 #endif //PIDTEMP
 #ifdef PIDTEMPBED
-    temp_iState_min_bed = 0.0;
-    temp_iState_max_bed = PID_INTEGRAL_DRIVE_MAX / bedKi;
+    temp_iState_min_bed = 0;
 #endif //PIDTEMPBED
   }
 
@@ -810,7 +1049,6 @@ void tp_init()
   #endif
 
   // Set analog inputs
-  ADCSRA = 1<<ADEN | 1<<ADSC | 1<<ADIF | 0x07;
   DIDR0 = 0;
   #ifdef DIDR2
     DIDR2 = 0;
@@ -844,72 +1082,37 @@ void tp_init()
     #endif
   #endif
 
-  // Use timer0 for temperature measurement
+  // The ADC runs on its own interrupt, timer0 collects the readings
+  adc_start();
   // Interleave temperature interrupt with millies interrupt
   OCR0B = 128;
   TIMSK0 |= (1<<OCIE0B);
 
 #ifdef HEATER_0_MINTEMP
   minttemp[0] = HEATER_0_MINTEMP;
-  while(analog2temp(minttemp_raw[0], 0) < HEATER_0_MINTEMP) {
-#if HEATER_0_RAW_LO_TEMP < HEATER_0_RAW_HI_TEMP
-    minttemp_raw[0] += OVERSAMPLENR;
-#else
-    minttemp_raw[0] -= OVERSAMPLENR;
-#endif
-  }
+  minttemp_raw[0] = analog_limit(minttemp_raw[0], HEATER_0_RAW_LO_TEMP < HEATER_0_RAW_HI_TEMP ? OVERSAMPLENR : -OVERSAMPLENR, HEATER_0_MINTEMP, true, 0);
 #endif //MINTEMP
 #ifdef HEATER_0_MAXTEMP
   maxttemp[0] = HEATER_0_MAXTEMP;
-  while(analog2temp(maxttemp_raw[0], 0) > HEATER_0_MAXTEMP) {
-#if HEATER_0_RAW_LO_TEMP < HEATER_0_RAW_HI_TEMP
-    maxttemp_raw[0] -= OVERSAMPLENR;
-#else
-    maxttemp_raw[0] += OVERSAMPLENR;
-#endif
-  }
+  maxttemp_raw[0] = analog_limit(maxttemp_raw[0], HEATER_0_RAW_LO_TEMP < HEATER_0_RAW_HI_TEMP ? -OVERSAMPLENR : OVERSAMPLENR, HEATER_0_MAXTEMP, false, 0);
 #endif //MAXTEMP
 
 #if (EXTRUDERS > 1) && defined(HEATER_1_MINTEMP)
   minttemp[1] = HEATER_1_MINTEMP;
-  while(analog2temp(minttemp_raw[1], 1) < HEATER_1_MINTEMP) {
-#if HEATER_1_RAW_LO_TEMP < HEATER_1_RAW_HI_TEMP
-    minttemp_raw[1] += OVERSAMPLENR;
-#else
-    minttemp_raw[1] -= OVERSAMPLENR;
-#endif
-  }
+  minttemp_raw[1] = analog_limit(minttemp_raw[1], HEATER_1_RAW_LO_TEMP < HEATER_1_RAW_HI_TEMP ? OVERSAMPLENR : -OVERSAMPLENR, HEATER_1_MINTEMP, true, 1);
 #endif // MINTEMP 1
 #if (EXTRUDERS > 1) && defined(HEATER_1_MAXTEMP)
   maxttemp[1] = HEATER_1_MAXTEMP;
-  while(analog2temp(maxttemp_raw[1], 1) > HEATER_1_MAXTEMP) {
-#if HEATER_1_RAW_LO_TEMP < HEATER_1_RAW_HI_TEMP
-    maxttemp_raw[1] -= OVERSAMPLENR;
-#else
-    maxttemp_raw[1] += OVERSAMPLENR;
-#endif
-  }
+  maxttemp_raw[1] = analog_limit(maxttemp_raw[1], HEATER_1_RAW_LO_TEMP < HEATER_1_RAW_HI_TEMP ? -OVERSAMPLENR : OVERSAMPLENR, HEATER_1_MAXTEMP, false, 1);
 #endif //MAXTEMP 1
 
 #if (EXTRUDERS > 2) && defined(HEATER_2_MINTEMP)
   minttemp[2] = HEATER_2_MINTEMP;
-  while(analog2temp(minttemp_raw[2], 2) < HEATER_2_MINTEMP) {
-#if HEATER_2_RAW_LO_TEMP < HEATER_2_RAW_HI_TEMP
-    minttemp_raw[2] += OVERSAMPLENR;
-#else
-    minttemp_raw[2] -= OVERSAMPLENR;
-#endif
-  }
+  minttemp_raw[2] = analog_limit(minttemp_raw[2], HEATER_2_RAW_LO_TEMP < HEATER_2_RAW_HI_TEMP ? OVERSAMPLENR : -OVERSAMPLENR, HEATER_2_MINTEMP, true, 2);
 #endif //MINTEMP 2
 #if (EXTRUDERS > 2) && defined(HEATER_2_MAXTEMP)
   maxttemp[2] = HEATER_2_MAXTEMP;
-  while(analog2temp(maxttemp_raw[2], 2) > HEATER_2_MAXTEMP) {
-#if HEATER_2_RAW_LO_TEMP < HEATER_2_RAW_HI_TEMP
-    maxttemp_raw[2] -= OVERSAMPLENR;
-#else
-    maxttemp_raw[2] += OVERSAMPLENR;
-#endif
-  }
+  maxttemp_raw[2] = analog_limit(maxttemp_raw[2], HEATER_2_RAW_LO_TEMP < HEATER_2_RAW_HI_TEMP ? -OVERSAMPLENR : OVERSAMPLENR, HEATER_2_MAXTEMP, false, 2);
 #endif //MAXTEMP 2
 
 #ifdef BED_MINTEMP
@@ -924,16 +1127,27 @@ void tp_init()
   */
 #endif //BED_MINTEMP
 #ifdef BED_MAXTEMP
-  while(analog2tempBed(bed_maxttemp_raw) > BED_MAXTEMP) {
-#if HEATER_BED_RAW_LO_TEMP < HEATER_BED_RAW_HI_TEMP
-    bed_maxttemp_raw -= OVERSAMPLENR;
-#else
-    bed_maxttemp_raw += OVERSAMPLENR;
-#endif
-  }
+  bed_maxttemp_raw = analog_limit(bed_maxttemp_raw, HEATER_BED_RAW_LO_TEMP < HEATER_BED_RAW_HI_TEMP ? -OVERSAMPLENR : OVERSAMPLENR, BED_MAXTEMP, false, 0xFF);
 #endif //BED_MAXTEMP
 }
 
+// The raw limit found by walking from raw in steps of step while the temperature is below (isMin) or above the limit.
+// The temperature changes monotonic along the walk, so the number of steps is found by bisection. e is 0xFF for the bed.
+static int analog_limit(int raw, int step, int limit, bool isMin, uint8_t e)
+{
+  int lo = 0, hi = 16384 / OVERSAMPLENR;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    float celsius = (e == 0xFF) ? analog2tempBed(raw + mid * step) : analog2temp(raw + mid * step, e);
+    if (isMin ? (celsius < limit) : (celsius > limit))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return raw + lo * step;
+}
+
 void setWatch()
 {
 #ifdef WATCH_TEMP_PERIOD
@@ -1089,17 +1303,177 @@ static int read_max6675()
 #endif
 
 
+//The ADC runs free at 125kHz, one conversion every 104us, and its interrupt steps through the temperature inputs.
+//Each visit of an input takes ADC_VISIT_SAMPLES conversions, the lowest and highest are dropped to reject spikes,
+//which leaves OVERSAMPLENR samples: the scale of the thermistor tables. ADC_ROUNDS visits of each input are averaged
+//into a reading, after that the ADC stops until timer 0 collects the reading, so a reading is still taken every PID_dT.
+//With 4 inputs a reading takes 60ms, which fits in PID_dT.
+#define ADC_VISIT_SAMPLES (OVERSAMPLENR + 2)
+#define ADC_ROUNDS 8
+
+#if defined(TEMP_0_PIN) && (TEMP_0_PIN > -1)
+  #define ADC_HAS_0 1
+#else
+  #define ADC_HAS_0 0
+#endif
+#if defined(TEMP_BED_PIN) && (TEMP_BED_PIN > -1)
+  #define ADC_HAS_BED 1
+#else
+  #define ADC_HAS_BED 0
+#endif
+#if defined(TEMP_1_PIN) && (TEMP_1_PIN > -1) && EXTRUDERS > 1
+  #define ADC_HAS_1 1
+#else
+  #define ADC_HAS_1 0
+#endif
+#if defined(TEMP_2_PIN) && (TEMP_2_PIN > -1) && EXTRUDERS > 2
+  #define ADC_HAS_2 1
+#else
+  #define ADC_HAS_2 0
+#endif
+#define ADC_INDEX_0 0
+#define ADC_INDEX_BED (ADC_INDEX_0 + ADC_HAS_0)
+#define ADC_INDEX_1 (ADC_INDEX_BED + ADC_HAS_BED)
+#define ADC_INDEX_2 (ADC_INDEX_1 + ADC_HAS_1)
+#define ADC_CHANNELS (ADC_INDEX_2 + ADC_HAS_2)
+
+static const uint8_t adc_channel_pin[ADC_CHANNELS] = {
+#if ADC_HAS_0
+  TEMP_0_PIN,
+#endif
+#if ADC_HAS_BED
+  TEMP_BED_PIN,
+#endif
+#if ADC_HAS_1
+  TEMP_1_PIN,
+#endif
+#if ADC_HAS_2
+  TEMP_2_PIN,
+#endif
+};
+
+static unsigned long adc_sum[ADC_CHANNELS];
+static volatile uint8_t adc_round;
+static uint8_t adc_channel;
+static uint8_t adc_visit_count;
+static uint16_t adc_visit_sum;
+static uint16_t adc_visit_min;
+static uint16_t adc_visit_max;
+
+static void adc_select(uint8_t pin)
+{
+  ADCSRB = (pin > 7) ? (1<<MUX5) : 0;
+  ADMUX = ((1 << REFS0) | (pin & 0x07));
+}
+
+static void adc_start_visit()
+{
+  adc_visit_count = 0;
+  adc_visit_sum = 0;
+  adc_visit_min = 0xFFFF;
+  adc_visit_max = 0;
+}
+
+//Start a new reading, the sums have to be cleared.
+static void adc_start()
+{
+  adc_round = 0;
+  adc_channel = 0;
+  adc_start_visit();
+  adc_select(adc_channel_pin[0]);
+  ADCSRA = 1<<ADEN | 1<<ADSC | 1<<ADATE | 1<<ADIF | 1<<ADIE | 0x07;
+}
+
+//The next conversion already runs when this interrupt comes, on the input that was selected when it started.
+//So the input for the next visit is selected one conversion before the current visit ends.
+ISR(ADC_vect)
+{
+  uint16_t value = ADC;
+  adc_visit_sum += value;
+  if (value < adc_visit_min)
+    adc_visit_min = value;
+  if (value > adc_visit_max)
+    adc_visit_max = value;
+  adc_visit_count++;
+  if (adc_visit_count == ADC_VISIT_SAMPLES - 1)
+  {
+    uint8_t next = adc_channel + 1;
+    if (next == ADC_CHANNELS)
+    {
+      next = 0;
+      if (adc_round == ADC_ROUNDS - 1)
+      {
+        //Last visit of this reading, stop after the conversion that runs now.
+        ADCSRA &= ~(1<<ADATE);
+        return;
+      }
+    }
+    adc_select(adc_channel_pin[next]);
+  }
+  else if (adc_visit_count == ADC_VISIT_SAMPLES)
+  {
+    adc_sum[adc_channel] += adc_visit_sum - adc_visit_min - adc_visit_max;
+    adc_start_visit();
+    adc_channel++;
+    if (adc_channel == ADC_CHANNELS)
+    {
+      adc_channel = 0;
+      adc_round++;
+    }
+  }
+}
+
 // Timer 0 is shared with millies
 ISR(TIMER0_COMPB_vect)
 {
   //these variables are only accesible from the ISR, but static, so they don't lose their value
   static unsigned char temp_count = 0;
-  static unsigned long raw_temp_0_value = 0;
-  static unsigned long raw_temp_1_value = 0;
-  static unsigned long raw_temp_2_value = 0;
-  static unsigned long raw_temp_bed_value = 0;
-  static unsigned char temp_state = 5;
   static unsigned char pwm_count = (1 << SOFT_PWM_SCALE);
+#ifdef HEATER_SIGMA_DELTA
+  static uint16_t sigma_delta_0;
+  #if EXTRUDERS > 1
+  static uint16_t sigma_delta_1;
+  #endif
+  #if EXTRUDERS > 2
+  static uint16_t sigma_delta_2;
+  #endif
+  #if defined(HEATER_BED_PIN) && HEATER_BED_PIN > -1
+  //The bed keeps the 7 bit soft PWM, its heater is too large to switch every tick.
+  static unsigned char soft_pwm_b;
+  #endif
+
+  //First order sigma-delta: the power is added every tick and the heater is on for the ticks where the sum reaches SOFT_PWM_ONE.
+  //soft_pwm is at most 0x0FF0, so a read while manage_heater writes it is still below SOFT_PWM_ONE and only affects this tick.
+  #define SIGMA_DELTA_HEATER(sum, pwm, pin) do { \
+      sum += pwm; \
+      if (sum >= SOFT_PWM_ONE) { sum -= SOFT_PWM_ONE; WRITE(pin,1); } else { WRITE(pin,0); } \
+    } while(0)
+  SIGMA_DELTA_HEATER(sigma_delta_0, soft_pwm[0], HEATER_0_PIN);
+  #if EXTRUDERS > 1
+  SIGMA_DELTA_HEATER(sigma_delta_1, soft_pwm[1], HEATER_1_PIN);
+  #endif
+  #if EXTRUDERS > 2
+  SIGMA_DELTA_HEATER(sigma_delta_2, soft_pwm[2], HEATER_2_PIN);
+  #endif
+
+  if(pwm_count == 0){
+    #if defined(HEATER_BED_PIN) && HEATER_BED_PIN > -1
+    //A read while manage_heater writes soft_pwm_bed can be off for this PWM period only.
+    soft_pwm_b = SOFT_PWM_POWER(soft_pwm_bed);
+    if(soft_pwm_b > 0) WRITE(HEATER_BED_PIN,1);
+    #endif
+    #ifdef FAN_SOFT_PWM
+    soft_pwm_fan = fanSpeedSoftPwm / 2;
+    if(soft_pwm_fan > 0) WRITE(FAN_PIN,1);
+    #endif
+  }
+  #if defined(HEATER_BED_PIN) && HEATER_BED_PIN > -1
+  if(soft_pwm_b <= pwm_count) WRITE(HEATER_BED_PIN,0);
+  #endif
+  #ifdef FAN_SOFT_PWM
+  if(soft_pwm_fan <= pwm_count) WRITE(FAN_PIN,0);
+  #endif
+#else
   static unsigned char soft_pwm_0;
   #if EXTRUDERS > 1
   static unsigned char soft_pwm_1;
@@ -1144,115 +1518,42 @@ ISR(TIMER0_COMPB_vect)
   #ifdef FAN_SOFT_PWM
   if(soft_pwm_fan <= pwm_count) WRITE(FAN_PIN,0);
   #endif
+#endif //HEATER_SIGMA_DELTA
 
   pwm_count += (1 << SOFT_PWM_SCALE);
   pwm_count &= 0x7f;
 
-  switch(temp_state) {
-    case 1: // Measure TEMP_0
-      #if defined(TEMP_0_PIN) && (TEMP_0_PIN > -1)
-        raw_temp_0_value += ADC;
-      #endif
-      // Prepare TEMP_BED
-      #if defined(TEMP_BED_PIN) && (TEMP_BED_PIN > -1)
-        #if TEMP_BED_PIN > 7
-          ADCSRB = 1<<MUX5;
-        #else
-          ADCSRB = 0;
-        #endif
-        ADMUX = ((1 << REFS0) | (TEMP_BED_PIN & 0x07));
-        ADCSRA |= 1<<ADSC; // Start conversion
-      #endif
-      lcd_buttons_update();
-      temp_state = 2;
-      break;
-    case 2: // Measure TEMP_BED
-      #if defined(TEMP_BED_PIN) && (TEMP_BED_PIN > -1)
-        raw_temp_bed_value += ADC;
-      #endif
-      // Prepare TEMP_1
-      #if defined(TEMP_1_PIN) && (TEMP_1_PIN > -1) && EXTRUDERS > 1
-        #if TEMP_1_PIN > 7
-          ADCSRB = 1<<MUX5;
-        #else
-          ADCSRB = 0;
-        #endif
-        ADMUX = ((1 << REFS0) | (TEMP_1_PIN & 0x07));
-        ADCSRA |= 1<<ADSC; // Start conversion
-      #endif
-      lcd_buttons_update();
-      temp_state = 3;
-      break;
-    case 3: // Measure TEMP_1
-      #if defined(TEMP_1_PIN) && (TEMP_1_PIN > -1) && EXTRUDERS > 1
-        raw_temp_1_value += ADC;
-      #endif
-      // Prepare TEMP_2
-      #if defined(TEMP_2_PIN) && (TEMP_2_PIN > -1) && EXTRUDERS > 2
-        #if TEMP_2_PIN > 7
-          ADCSRB = 1<<MUX5;
-        #else
-          ADCSRB = 0;
-        #endif
-        ADMUX = ((1 << REFS0) | (TEMP_2_PIN & 0x07));
-        ADCSRA |= 1<<ADSC; // Start conversion
-      #endif
-      lcd_buttons_update();
-      temp_state = 4;
-      break;
-    case 4: // Measure TEMP_2
-      #if defined(TEMP_2_PIN) && (TEMP_2_PIN > -1) && EXTRUDERS > 2
-        raw_temp_2_value += ADC;
-      #endif
-      temp_count++;
-      //Fall trough to state 0
-    case 0: // Prepare TEMP_0
-      #if defined(TEMP_0_PIN) && (TEMP_0_PIN > -1)
-        #if TEMP_0_PIN > 7
-          ADCSRB = 1<<MUX5;
-        #else
-          ADCSRB = 0;
-        #endif
-        ADMUX = ((1 << REFS0) | (TEMP_0_PIN & 0x07));
-        ADCSRA |= 1<<ADSC; // Start conversion
-      #endif
-      lcd_buttons_update();
-      temp_state = 1;
-      break;
-    case 5: //Startup, delay initial temp reading a tiny bit so the hardware can settle.
-      temp_state = 0;
-      break;
-//    default:
-//      SERIAL_ERROR_START;
-//      SERIAL_ERRORLNPGM("Temp measurement error!");
-//      break;
-  }
+  lcd_buttons_update();
 
-  if(temp_count >= OVERSAMPLENR) // 8 ms * 16 = 128ms.
+  if(temp_count < OVERSAMPLENR * 4)
+    temp_count++;
+  //Every OVERSAMPLENR * 4 ticks (PID_dT), or as soon after that as the ADC has finished the reading.
+  if(temp_count >= OVERSAMPLENR * 4 && adc_round == ADC_ROUNDS)
   {
     if (!temp_meas_ready) //Only update the raw values if they have been read. Else we could be updating them during reading.
     {
-#ifndef HEATER_0_USES_MAX6675
-      current_temperature_raw[0] = raw_temp_0_value;
+#if !defined(HEATER_0_USES_MAX6675) && ADC_HAS_0
+      current_temperature_raw[0] = adc_sum[ADC_INDEX_0] / ADC_ROUNDS;
 #endif
-#if EXTRUDERS > 1
-      current_temperature_raw[1] = raw_temp_1_value;
+#if ADC_HAS_1
+      current_temperature_raw[1] = adc_sum[ADC_INDEX_1] / ADC_ROUNDS;
 #endif
-#ifdef TEMP_SENSOR_1_AS_REDUNDANT
-      redundant_temperature_raw = raw_temp_1_value;
+#if defined(TEMP_SENSOR_1_AS_REDUNDANT) && ADC_HAS_1
+      redundant_temperature_raw = adc_sum[ADC_INDEX_1] / ADC_ROUNDS;
 #endif
-#if EXTRUDERS > 2
-      current_temperature_raw[2] = raw_temp_2_value;
+#if ADC_HAS_2
+      current_temperature_raw[2] = adc_sum[ADC_INDEX_2] / ADC_ROUNDS;
+#endif
+#if ADC_HAS_BED
+      current_temperature_bed_raw = adc_sum[ADC_INDEX_BED] / ADC_ROUNDS;
 #endif
-      current_temperature_bed_raw = raw_temp_bed_value;
     }
 
     temp_meas_ready = true;
     temp_count = 0;
-    raw_temp_0_value = 0;
-    raw_temp_1_value = 0;
-    raw_temp_2_value = 0;
-    raw_temp_bed_value = 0;
+    for(uint8_t n=0; n<ADC_CHANNELS; n++)
+      adc_sum[n] = 0;
+    adc_start();
 
 #if HEATER_0_RAW_LO_TEMP > HEATER_0_RAW_HI_TEMP
     if(current_temperature_raw[0] <= maxttemp_raw[0]) {
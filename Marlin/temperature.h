@@ -148,7 +148,8 @@ FORCE_INLINE void autotempShutdown(){
  #endif
 }
 
-void PID_autotune(float temp, int extruder, int ncycles);
+//With PID_ADD_EXTRUSION_RATE and an e_speed (mm/sec of filament) it also extrudes to measure Kc.
+void PID_autotune(float temp, int extruder, int ncycles, float e_speed=0);
 
 #endif
 
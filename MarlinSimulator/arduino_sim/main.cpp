@@ -1,7 +1,10 @@
 #include <Arduino.h>
 
-int main(void)
+extern void sim_parse_args(int argc, char** argv);
+
+int main(int argc, char** argv)
 {
+	sim_parse_args(argc, argv);
 	init();
 
 #if defined(USBCON)
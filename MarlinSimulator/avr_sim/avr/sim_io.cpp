@@ -19,9 +19,11 @@ extern void TWI_vect();
 extern void TIMER0_OVF_vect();
 extern void TIMER0_COMPB_vect();
 extern void TIMER1_COMPA_vect();
+extern void ADC_vect();
 
 unsigned int prevTicks = SDL_GetTicks();
 unsigned int twiIntStart = 0;
+unsigned int adcClocks = 0;
 
 //After an interrupt we need to set the interrupt flag again, but do this without calling sim_check_interrupts so the interrupt does not fire recursively
 #define _sei() do { SREG.forceValue(SREG | _BV(SREG_I)); } while(0)
@@ -97,6 +99,32 @@ void sim_check_interrupts()
             }
             TCNT1 = ticks;
         }
+
+        //An ADC conversion takes 13 ADC clocks. The ADC component samples the selected input when a conversion is started,
+        //in free running mode the next conversion starts when one completes, before the interrupt can select another input.
+        if ((ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADSC)) && (ADCSRA & _BV(ADIE)))
+        {
+            unsigned int prescale = ADCSRA & (_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0));
+            adcClocks += (F_CPU / 1000 * tickDiff) >> (prescale ? prescale : 1);
+            while(adcClocks >= 13 && (ADCSRA & _BV(ADSC)))
+            {
+                adcClocks -= 13;
+                uint16_t result = ADC;
+                if (ADCSRA & _BV(ADATE))
+                {
+                    ADCSRA = ADCSRA | _BV(ADSC);
+                    uint16_t next = ADC;
+                    ADC = result;
+                    ADC_vect();
+                    ADC = next;
+                }else{
+                    ADCSRA.forceValue(ADCSRA & ~_BV(ADSC));
+                    ADC_vect();
+                }
+            }
+        }else{
+            adcClocks = 0;
+        }
         _sei();
     }
 }
@@ -1,32 +1,155 @@
+#include <SDL/SDL.h>
+#include <avr/io.h>
 #include "heater.h"
 #include "arduinoIO.h"
+#include "../../Marlin/Configuration.h"
 
-heaterSim::heaterSim(int heaterPinNr, adcSim* adc, int temperatureADCNr, float heaterStrength)
+#define AMBIENT_TEMPERATURE 20.0
+//Heat needed to warm up 1mm3 of PLA by 1C in J, 1.24g/cm3 at 1.8J/gK.
+#define FILAMENT_HEAT_CAPACITY 0.0022
+
+heaterSim::heaterSim(arduinoIOSim* arduinoIO, int heaterPinNr, adcSim* adc, int temperatureADCNr, const short (*temptable)[2], int temptableLen, float power, float heatCapacity, float ambientLoss, float sensorDelay)
 {
     this->heaterPinNr = heaterPinNr;
     this->adc = adc;
     this->temperatureADCNr = temperatureADCNr;
-    this->heaterStrength = heaterStrength;
-    
-    this->temperature = 20;
+    this->temptable = temptable;
+    this->temptableLen = temptableLen;
+    this->power = power;
+    this->heatCapacity = heatCapacity;
+    this->ambientLoss = ambientLoss;
+    this->sensorDelay = sensorDelay;
+
+    this->fanPinNr = -1;
+    this->fanLoss = 0;
+    this->extruder = NULL;
+    this->stepHeatCapacity = 0;
+    this->extruderPosition = 0;
+
+    this->temperature = AMBIENT_TEMPERATURE;
+    this->sensorTemperature = AMBIENT_TEMPERATURE;
+    this->lastTicks = SDL_GetTicks();
+
+    this->heaterOn = false;
+    this->heaterOnMillis = 0;
+    this->onTime = 0;
+    this->lastMillis = millis();
+    arduinoIO->registerPortCallback(heaterPinNr, DELEGATE(ioDelegate, heaterSim, *this, heaterPinUpdate));
 }
 
 heaterSim::~heaterSim()
 {
 }
 
+void heaterSim::setFan(int fanPinNr, float fanLoss)
+{
+    this->fanPinNr = fanPinNr;
+    this->fanLoss = fanLoss;
+}
+
+void heaterSim::setFilament(stepperSim* extruder, float stepsPerMM, float filamentDiameter)
+{
+    this->extruder = extruder;
+    this->stepHeatCapacity = filamentDiameter * filamentDiameter * M_PI / 4.0 / stepsPerMM * FILAMENT_HEAT_CAPACITY;
+    this->extruderPosition = extruder->getPosition();
+}
+
+//Fraction of the time the pin is high, from the compare register when the pin is driven by a timer (analogWrite).
+static float pinDutyCycle(int pinNr)
+{
+    switch(digitalPinToTimer(pinNr))
+    {
+    case TIMER3A: if (TCCR3A & _BV(COM3A1)) return float(OCR3A) / 255.0; break;
+    case TIMER3B: if (TCCR3A & _BV(COM3B1)) return float(OCR3B) / 255.0; break;
+    case TIMER3C: if (TCCR3A & _BV(COM3C1)) return float(OCR3C) / 255.0; break;
+    case TIMER4A: if (TCCR4A & _BV(COM4A1)) return float(OCR4A) / 255.0; break;
+    case TIMER4B: if (TCCR4A & _BV(COM4B1)) return float(OCR4B) / 255.0; break;
+    case TIMER4C: if (TCCR4A & _BV(COM4C1)) return float(OCR4C) / 255.0; break;
+    }
+    return readOutput(pinNr) ? 1.0 : 0.0;
+}
+
+void heaterSim::heaterPinUpdate(int pinNr, bool high)
+{
+    if (high == heaterOn)
+        return;
+    if (high)
+        heaterOnMillis = millis();
+    else
+        onTime += millis() - heaterOnMillis;
+    heaterOn = high;
+}
+
 void heaterSim::tick()
 {
-    if (readOutput(heaterPinNr))
-        temperature += 0.03 * heaterStrength;
-    else if (temperature > 20)
-        temperature -= 0.03 * heaterStrength;
-    adc->adcValue[temperatureADCNr] = 231 + temperature * 81 / 100;//Not accurate, but accurate enough.
+    unsigned int ticks = SDL_GetTicks();
+    //Limit the step when the simulation was stalled, so the temperature does not jump.
+    float dt = float(ticks - lastTicks) / 1000.0;
+    lastTicks = ticks;
+    if (dt > 0.1)
+        dt = 0.1;
+
+    //Fraction of the firmware milliseconds since the last step the heater was on, the pin can switch every Timer0 tick.
+    unsigned long now = millis();
+    if (heaterOn)
+    {
+        onTime += now - heaterOnMillis;
+        heaterOnMillis = now;
+    }
+    float duty = heaterOn ? 1.0 : 0.0;
+    if (now != lastMillis)
+        duty = float(onTime) / float(now - lastMillis);
+    onTime = 0;
+    lastMillis = now;
+
+    //Energy in J over this step.
+    float energy = power * duty * dt;
+    float loss = ambientLoss;
+    if (fanPinNr > -1)
+        loss += fanLoss * pinDutyCycle(fanPinNr);
+    energy -= loss * (temperature - AMBIENT_TEMPERATURE) * dt;
+    if (extruder)
+    {
+        int position = extruder->getPosition();
+        //Retractions pull cold filament back out, only the forward moves take heat away.
+        if (position > extruderPosition)
+            energy -= stepHeatCapacity * (position - extruderPosition) * (temperature - AMBIENT_TEMPERATURE);
+        extruderPosition = position;
+    }
+    temperature += energy / heatCapacity;
+
+    sensorTemperature += (temperature - sensorTemperature) * dt / (sensorDelay + dt);
+    adc->adcValue[temperatureADCNr] = temperatureToADC(sensorTemperature);
+}
+
+//Inverse of analog2temp, interpolates between the table entries. The tables list raw values times OVERSAMPLENR, they can run either way.
+int heaterSim::temperatureToADC(float temp)
+{
+    if (temptableLen < 2)
+        return 0;
+    bool rising = temptable[temptableLen - 1][1] > temptable[0][1];
+    int first = rising ? 0 : temptableLen - 1;
+    int last = rising ? temptableLen - 1 : 0;
+    if (temp <= temptable[first][1])
+        return temptable[first][0] / OVERSAMPLENR;
+    if (temp >= temptable[last][1])
+        return temptable[last][0] / OVERSAMPLENR;
+    for(int n=1; n<temptableLen; n++)
+    {
+        float t0 = temptable[n-1][1];
+        float t1 = temptable[n][1];
+        if ((temp >= t0 && temp <= t1) || (temp <= t0 && temp >= t1))
+        {
+            float raw = temptable[n-1][0] + (temptable[n][0] - temptable[n-1][0]) * (temp - t0) / (t1 - t0);
+            return int(raw / OVERSAMPLENR + 0.5);
+        }
+    }
+    return temptable[last][0] / OVERSAMPLENR;
 }
 
 void heaterSim::draw(int x, int y)
 {
     char buffer[32];
-    sprintf(buffer, "%iC", int(temperature));
+    sprintf(buffer, "%iC", int(sensorTemperature));
     drawString(x, y, buffer, 0xFFFFFF);
 }
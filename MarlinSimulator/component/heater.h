@@ -3,22 +3,52 @@
 
 #include "base.h"
 #include "adc.h"
+#include "stepper.h"
+#include "arduinoIO.h"
 
+//Lumped thermal model of a heater block. The heater and the losses change the temperature of the block,
+//the thermistor follows the block with a first order lag. The ADC value comes from the thermistor table the firmware uses.
 class heaterSim : public simBaseComponent
 {
 public:
-    heaterSim(int heaterPinNr, adcSim* adc, int temperatureADCNr, float heaterStrength = 1.0);
+    //power in W, heatCapacity in J/K, ambientLoss in W/K, sensorDelay is the time constant of the thermistor in seconds.
+    heaterSim(arduinoIOSim* arduinoIO, int heaterPinNr, adcSim* adc, int temperatureADCNr, const short (*temptable)[2], int temptableLen, float power, float heatCapacity, float ambientLoss, float sensorDelay);
     virtual ~heaterSim();
-    
+
+    //Extra loss in W/K with the fan at full speed.
+    void setFan(int fanPinNr, float fanLoss);
+    //Filament pushed through the block is heated from the ambient temperature to the block temperature.
+    void setFilament(stepperSim* extruder, float stepsPerMM, float filamentDiameter);
+
     virtual void tick();
     virtual void draw(int x, int y);
 private:
     float temperature;
-    float heaterStrength;
+    float sensorTemperature;
+    float power, heatCapacity, ambientLoss, sensorDelay;
+    unsigned int lastTicks;
+
+    //Time the heater pin was high since the last tick, counted in firmware milliseconds so the Timer0 ticks the simulation runs in one go still count.
+    bool heaterOn;
+    unsigned long heaterOnMillis;
+    unsigned long onTime;
+    unsigned long lastMillis;
 
     int heaterPinNr;
     adcSim* adc;
     int temperatureADCNr;
+    const short (*temptable)[2];
+    int temptableLen;
+
+    int fanPinNr;
+    float fanLoss;
+
+    stepperSim* extruder;
+    float stepHeatCapacity;
+    int extruderPosition;
+
+    int temperatureToADC(float temp);
+    void heaterPinUpdate(int pinNr, bool high);
 };
 
-#endif//I2C_SIM_H
+#endif//HEATER_SIM_H
@@ -1,23 +1,28 @@
 #include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
 #include <avr/io.h>
 
 #include "sdcard.h"
 #include "../../Marlin/SdFatStructs.h"
+#include "../../Marlin/SdInfo.h"
 
-sdcardSimulation::sdcardSimulation(const char* basePath, int errorRate)
-: errorRate(errorRate)
-{
-    this->basePath = basePath;
-    
-    SPDR.setCallback(DELEGATE(registerDelegate, sdcardSimulation, *this, ISP_SPDR_callback));
+//Layout of a generated image: MBR, the partition starts at 1MB like on a card formatted by a PC.
+#define SD_SIM_PARTITION_START 2048
+#define SD_SIM_RESERVED_BLOCKS 32
+#define SD_SIM_FAT_COUNT 2
+#define SD_SIM_BLOCKS_PER_CLUSTER 1
+#define SD_SIM_CLUSTER_SIZE (512 * SD_SIM_BLOCKS_PER_CLUSTER)
+//SdVolume sees a volume with less than 65525 clusters as FAT16.
+#define SD_SIM_MIN_CLUSTERS 65536
+//Free space left for uploads and logs.
+#define SD_SIM_FREE_CLUSTERS 65536
 
-    sd_state = 0;
-    sd_buffer_pos = 0;
-}
-
-sdcardSimulation::~sdcardSimulation()
-{
-}
+#define SD_STATE_IDLE 0
+#define SD_STATE_READ 1
+#define SD_STATE_WRITE_WAIT 2
+#define SD_STATE_WRITE_DATA 3
 
 static const uint16_t crctab[] = {
   0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
@@ -61,207 +66,627 @@ static uint16_t CRC_CCITT(const uint8_t* data, size_t n) {
   return crc;
 }
 
-FILE* simFile;
-//Total crappy fake FAT32 simulation, works for 1 file, sort of.
-void sdcardSimulation::read_sd_block(int nr)
+struct fatImageEntry
+{
+    std::string name;
+    std::string path;
+    bool isDir;
+    uint32_t size;
+    time_t mtime;
+    uint8_t shortName[11];
+    int lfnCount;
+    uint32_t clusterCount;
+    uint32_t firstCluster;
+    std::vector<fatImageEntry> children;
+};
+
+static bool shortNameChar(char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c != '\0' && strchr("$%'-_@~`!(){}^#&", c));
+}
+
+//Make the 8.3 name, returns false when it differs from the name and a long filename is needed.
+static bool makeShortName(const char* name, int tail, uint8_t* shortName)
+{
+    const char* dot = strrchr(name, '.');
+    int baseLen = dot ? dot - name : strlen(name);
+    bool exact = baseLen > 0 && baseLen <= 8;
+    int n = 0;
+
+    memset(shortName, ' ', 11);
+    for(int i=0; i<baseLen; i++)
+    {
+        if (!shortNameChar(name[i]) || islower((unsigned char)name[i]))
+            exact = false;
+        if (shortNameChar(name[i]) && n < 8)
+            shortName[n++] = toupper(name[i]);
+    }
+    int baseChars = n;
+    if (dot)
+    {
+        if (strlen(dot + 1) < 1 || strlen(dot + 1) > 3)
+            exact = false;
+        n = 0;
+        for(const char* c = dot + 1; *c; c++)
+        {
+            if (!shortNameChar(*c) || islower((unsigned char)*c))
+                exact = false;
+            if (shortNameChar(*c) && n < 3)
+                shortName[8 + n++] = toupper(*c);
+        }
+    }
+    if (exact)
+        return true;
+
+    //Numeric tail like a PC makes: LONGNA~1.GCO
+    char tailStr[8];
+    sprintf(tailStr, "~%i", tail);
+    int tailLen = strlen(tailStr);
+    int pos = baseChars < 8 - tailLen ? baseChars : 8 - tailLen;
+    memset(shortName + pos, ' ', 8 - pos);
+    memcpy(shortName + pos, tailStr, tailLen);
+    return false;
+}
+
+static uint8_t lfnChecksum(const uint8_t* shortName)
+{
+    uint8_t sum = 0;
+    for(int n=0; n<11; n++)
+        sum = ((sum & 1) << 7) + (sum >> 1) + shortName[n];
+    return sum;
+}
+
+static void setLfnChar(vfat_t* vfat, int n, uint16_t c)
+{
+    uint8_t* p;
+    if (n < 5)
+        p = &vfat->name1[n * 2];
+    else if (n < 11)
+        p = &vfat->name2[(n - 5) * 2];
+    else
+        p = &vfat->name3[(n - 11) * 2];
+    p[0] = c;
+    p[1] = c >> 8;
+}
+
+static uint32_t clustersFor(uint32_t size)
+{
+    return (size + SD_SIM_CLUSTER_SIZE - 1) / SD_SIM_CLUSTER_SIZE;
+}
+
+//Builds a formatted FAT32 image with the files of a host directory.
+class fatImageBuilder
 {
-    memset(sd_buffer, 0, 512);
-    switch(nr)
+public:
+    fatImageBuilder(int fragmentRun) : fragmentRun(fragmentRun), image(NULL), usedClusters(0) {}
+
+    uint8_t* build(const char* path, uint32_t* blockCount)
     {
-    case 0x000:{//MBR
-        mbr_t* mbr = (mbr_t*)sd_buffer;
-        mbr->part[0].boot = 0;
-        mbr->part[0].totalSectors = 0x200000;
-        mbr->part[0].firstSector = 1;
-        }break;
-    case 0x001:{//fat32_boot_t
-        fat32_boot_t* boot = (fat32_boot_t*)sd_buffer;
+        fatImageEntry root;
+        root.path = path;
+        root.isDir = true;
+        root.mtime = time(NULL);
+        scan(root, true);
+
+        uint32_t clusterCount = usedClusters + SD_SIM_FREE_CLUSTERS;
+        if (clusterCount < SD_SIM_MIN_CLUSTERS)
+            clusterCount = SD_SIM_MIN_CLUSTERS;
+        uint32_t fatBlocks = ((clusterCount + 2) * 4 + 511) / 512;
+        uint32_t partitionBlocks = SD_SIM_RESERVED_BLOCKS + SD_SIM_FAT_COUNT * fatBlocks + clusterCount * SD_SIM_BLOCKS_PER_CLUSTER;
+        *blockCount = SD_SIM_PARTITION_START + partitionBlocks;
+        image = (uint8_t*)calloc(*blockCount, 512);
+        if (image == NULL)
+        {
+            printf("SD image of %u blocks does not fit in memory\n", *blockCount);
+            exit(1);
+        }
+        fatStart = SD_SIM_PARTITION_START + SD_SIM_RESERVED_BLOCKS;
+        fatSize = fatBlocks * 512;
+        dataStart = fatStart + SD_SIM_FAT_COUNT * fatBlocks;
+        nextCluster = 2;
+
+        mbr_t* mbr = (mbr_t*)image;
+        mbr->part[0].type = 0x0C;//FAT32 LBA
+        mbr->part[0].firstSector = SD_SIM_PARTITION_START;
+        mbr->part[0].totalSectors = partitionBlocks;
+        mbr->mbrSig0 = 0x55;
+        mbr->mbrSig1 = 0xAA;
+
+        fat32_boot_t* boot = (fat32_boot_t*)(image + SD_SIM_PARTITION_START * 512);
+        boot->jump[0] = 0xEB;
+        boot->jump[1] = 0x58;
+        boot->jump[2] = 0x90;
+        memcpy(boot->oemId, "MARLNSIM", 8);
         boot->bytesPerSector = 512;
-        boot->fatCount = 1;
-        boot->reservedSectorCount = 1;
-        boot->sectorsPerCluster = 1;
-        boot->sectorsPerFat32 = 0x400;
-        boot->rootDirEntryCount = 0;
-        boot->fat32RootCluster = 1;
-        }break;
-    case 0x002:{//FAT32 for root dir entries
-        uint32_t* fat32 = (uint32_t*)sd_buffer;
-        for(uint8_t n=0;n<128;n++)
-            fat32[n] = 0X0FFFFFF8;
-        for(uint8_t n=0;n<128;n++)
-            fat32[n] = n + 1;
-        fat32[127] = 0X0FFFFFF8;
-        }break;
-    default:
-        if (nr >= 0x401 && nr < 0x500) //root directory: dir_t
+        boot->sectorsPerCluster = SD_SIM_BLOCKS_PER_CLUSTER;
+        boot->reservedSectorCount = SD_SIM_RESERVED_BLOCKS;
+        boot->fatCount = SD_SIM_FAT_COUNT;
+        boot->mediaType = 0xF8;
+        boot->hidddenSectors = SD_SIM_PARTITION_START;
+        boot->totalSectors32 = partitionBlocks;
+        boot->sectorsPerFat32 = fatBlocks;
+        boot->fat32RootCluster = 2;
+        boot->fat32FSInfo = 1;
+        boot->bootSignature = 0x29;
+        memcpy(boot->volumeLabel, "NO NAME    ", 11);
+        memcpy(boot->fileSystemType, "FAT32   ", 8);
+        boot->bootSectorSig0 = 0x55;
+        boot->bootSectorSig1 = 0xAA;
+
+        fat32_fsinfo_t* fsinfo = (fat32_fsinfo_t*)(image + (SD_SIM_PARTITION_START + 1) * 512);
+        fsinfo->leadSignature = FSINFO_LEAD_SIG;
+        fsinfo->structSignature = FSINFO_STRUCT_SIG;
+        fsinfo->freeCount = 0xFFFFFFFF;
+        fsinfo->nextFree = 0xFFFFFFFF;
+        fsinfo->tailSignature[2] = 0x55;
+        fsinfo->tailSignature[3] = 0xAA;
+
+        setFat(0, 0x0FFFFFF8);
+        setFat(1, FAT32EOC);
+        root.firstCluster = allocate(root.clusterCount);
+        write(root, 0, true);
+        return image;
+    }
+private:
+    int fragmentRun;
+    uint8_t* image;
+    uint32_t usedClusters;
+    uint32_t fatStart, fatSize, dataStart;
+    uint32_t nextCluster;
+
+    //Read the host directory and count the clusters needed, including the gaps between fragments.
+    void scan(fatImageEntry& dir, bool isRoot)
+    {
+        DIR* dh = opendir(dir.path.c_str());
+        if (dh == NULL)
         {
-            dir_t* dir = (dir_t*)sd_buffer;
-            
-            DIR* dh = opendir(basePath);
-            struct dirent *entry;
-            int idx = 0;
-            int reqIdx = nr - 0x401;
-            while((entry=readdir(dh))!=NULL)
+            printf("Cannot read SD directory: %s\n", dir.path.c_str());
+            exit(1);
+        }
+        struct dirent* ent;
+        int tail = 1;
+        int entryCount = isRoot ? 1 : 3;//Dot entries and the end of directory marker
+        while((ent = readdir(dh)) != NULL)
+        {
+            if (ent->d_name[0] == '.')
+                continue;
+            fatImageEntry e;
+            struct stat st;
+            e.name = ent->d_name;
+            e.path = dir.path + "/" + e.name;
+            if (stat(e.path.c_str(), &st) != 0)
+                continue;
+            e.isDir = S_ISDIR(st.st_mode);
+            e.size = e.isDir ? 0 : st.st_size;
+            e.mtime = st.st_mtime;
+            e.lfnCount = 0;
+            if (!makeShortName(ent->d_name, tail, e.shortName))
             {
-                if (entry->d_name[0] == '.')
-                    continue;
-                if (idx == reqIdx)
-                    break;
-                idx++;
+                e.lfnCount = (e.name.length() + 12) / 13;
+                tail++;
             }
-            if (entry == NULL)
-                return;
+            e.firstCluster = 0;
+            if (e.isDir)
+                scan(e, false);
+            else
+                e.clusterCount = clustersFor(e.size);
+            usedClusters += fragmentedSize(e.clusterCount);
+            entryCount += 1 + e.lfnCount;
+            dir.children.push_back(e);
+        }
+        closedir(dh);
+        dir.clusterCount = clustersFor(entryCount * sizeof(dir_t));
+        if (isRoot)
+            usedClusters += fragmentedSize(dir.clusterCount);
+    }
+
+    uint32_t fragmentedSize(uint32_t count)
+    {
+        if (fragmentRun < 1 || count < 1)
+            return count;
+        return count + (count - 1) / fragmentRun * fragmentRun;
+    }
+
+    void setFat(uint32_t cluster, uint32_t value)
+    {
+        for(int n=0; n<SD_SIM_FAT_COUNT; n++)
+            ((uint32_t*)(image + fatStart * 512 + n * fatSize))[cluster] = value;
+    }
+
+    uint32_t getFat(uint32_t cluster)
+    {
+        return ((uint32_t*)(image + fatStart * 512))[cluster];
+    }
+
+    uint32_t allocate(uint32_t count)
+    {
+        uint32_t first = 0, prev = 0;
+        for(uint32_t n=0; n<count; n++)
+        {
+            //Leave a gap of free clusters, the file continues after it.
+            if (fragmentRun > 0 && n > 0 && n % fragmentRun == 0)
+                nextCluster += fragmentRun;
+            if (prev)
+                setFat(prev, nextCluster);
+            else
+                first = nextCluster;
+            prev = nextCluster++;
+        }
+        if (prev)
+            setFat(prev, FAT32EOC);
+        return first;
+    }
+
+    void writeChain(uint32_t cluster, const uint8_t* data, uint32_t size)
+    {
+        while(size > 0)
+        {
+            uint32_t n = size < SD_SIM_CLUSTER_SIZE ? size : SD_SIM_CLUSTER_SIZE;
+            memcpy(image + size_t(dataStart + (cluster - 2) * SD_SIM_BLOCKS_PER_CLUSTER) * 512, data, n);
+            data += n;
+            size -= n;
+            cluster = getFat(cluster);
+        }
+    }
 
-            const char* namePtr = entry->d_name;
-            
-            int fatNr = 0;
-            while(*namePtr)
+    void setEntry(dir_t* d, const uint8_t* name, uint8_t attributes, uint32_t cluster, uint32_t size, time_t mtime)
+    {
+        struct tm* t = localtime(&mtime);
+        memcpy(d->name, name, 11);
+        d->attributes = attributes;
+        d->firstClusterHigh = cluster >> 16;
+        d->firstClusterLow = cluster;
+        d->fileSize = size;
+        if (t && t->tm_year >= 80)
+        {
+            d->lastWriteDate = ((t->tm_year - 80) << 9) | ((t->tm_mon + 1) << 5) | t->tm_mday;
+            d->lastWriteTime = (t->tm_hour << 11) | (t->tm_min << 5) | (t->tm_sec >> 1);
+        }
+        d->creationDate = d->lastWriteDate;
+        d->creationTime = d->lastWriteTime;
+        d->lastAccessDate = d->lastWriteDate;
+    }
+
+    //Allocate the contents of a directory and write them, the directory itself is already allocated.
+    void write(fatImageEntry& dir, uint32_t parentCluster, bool isRoot)
+    {
+        std::vector<uint8_t> data(dir.clusterCount * SD_SIM_CLUSTER_SIZE, 0);
+        dir_t* d = (dir_t*)&data[0];
+        if (!isRoot)
+        {
+            setEntry(d++, (const uint8_t*)".          ", DIR_ATT_DIRECTORY, dir.firstCluster, 0, dir.mtime);
+            setEntry(d++, (const uint8_t*)"..         ", DIR_ATT_DIRECTORY, parentCluster, 0, dir.mtime);
+        }
+        for(unsigned int i=0; i<dir.children.size(); i++)
+        {
+            fatImageEntry& e = dir.children[i];
+            e.firstCluster = allocate(e.clusterCount);
+            if (e.isDir)
             {
-                vfat_t *vfat = (vfat_t*)dir;
-                vfat->firstClusterLow = 0;
-                vfat->sequenceNumber = 0x41 + fatNr;
-                for(unsigned int n=0;n<5&&*namePtr;n++)
-                    vfat->name1[n*2] = *namePtr++;
-                for(unsigned int n=0;n<6&&*namePtr;n++)
-                    vfat->name2[n*2] = *namePtr++;
-                for(unsigned int n=0;n<2&&*namePtr;n++)
-                    vfat->name3[n*2] = *namePtr++;
-                vfat->attributes = DIR_ATT_LONG_NAME;
-                dir++;
-                fatNr++;
+                write(e, isRoot ? 0 : dir.firstCluster, false);
+            }else if (e.size > 0)
+            {
+                std::vector<uint8_t> contents(e.size);
+                FILE* f = fopen(e.path.c_str(), "rb");
+                if (f == NULL || fread(&contents[0], e.size, 1, f) != 1)
+                    printf("Cannot read SD file: %s\n", e.path.c_str());
+                if (f)
+                    fclose(f);
+                writeChain(e.firstCluster, &contents[0], e.size);
             }
 
-            dir->attributes = 0;
-            memcpy(dir->name, "FAKEFILEXCO", 8+3);
-            if (strrchr(entry->d_name, '.'))
-                dir->name[8] = toupper(strrchr(entry->d_name, '.')[1]);
-            dir->firstClusterHigh = 0;
-            dir->firstClusterLow = 256;
-            if (simFile == NULL)
-                simFile = fopen("c:/models/Box_20x20x10.gcode", "rb");
-            fseek(simFile, 0, SEEK_END);
-            dir->fileSize = ftell(simFile);
-            fseek(simFile, 0, SEEK_SET);
-            
-            dir++;
-            fatNr++;
-
-            closedir(dh);
-            
-            while(fatNr < 16)
+            //Long filename entries are stored last part first, before the 8.3 entry.
+            uint8_t checksum = lfnChecksum(e.shortName);
+            for(int n=e.lfnCount; n>0; n--)
             {
-                dir->attributes = DIR_ATT_HIDDEN;
-                dir->name[0] = DIR_NAME_DELETED;
-
-                dir++;
-                fatNr++;
+                vfat_t* vfat = (vfat_t*)d++;
+                vfat->sequenceNumber = n | (n == e.lfnCount ? 0x40 : 0);
+                vfat->attributes = DIR_ATT_LONG_NAME;
+                vfat->checksum = checksum;
+                for(int c=0; c<13; c++)
+                {
+                    unsigned int idx = (n - 1) * 13 + c;
+                    if (idx < e.name.length())
+                        setLfnChar(vfat, c, uint8_t(e.name[idx]));
+                    else
+                        setLfnChar(vfat, c, idx == e.name.length() ? 0x0000 : 0xFFFF);
+                }
             }
+            setEntry(d++, e.shortName, e.isDir ? DIR_ATT_DIRECTORY : DIR_ATT_ARCHIVE, e.firstCluster, e.size, e.mtime);
         }
-        else if (nr >= 4 && nr < 0x400)
+        writeChain(dir.firstCluster, &data[0], data.size());
+    }
+};
+
+sdcardSimulation::sdcardSimulation(const char* basePath, int errorRate, int fragmentRun)
+: errorRate(errorRate)
+{
+    struct stat st;
+    if (stat(basePath, &st) == 0 && S_ISREG(st.st_mode))
+        loadImage(basePath);
+    else
+        buildImage(basePath, fragmentRun);
+
+    SPDR.setCallback(DELEGATE(registerDelegate, sdcardSimulation, *this, ISP_SPDR_callback));
+
+    for(int n=0; n<64; n++)
+        latency[n] = 0;
+    blocksRead = blocksWritten = 0;
+    readCommands = writeCommands = 0;
+    state = SD_STATE_IDLE;
+    appCmd = false;
+    cmdPos = 0;
+    responseLen = responsePos = 0;
+    delay = busy = 0;
+}
+
+sdcardSimulation::~sdcardSimulation()
+{
+    free(image);
+}
+
+void sdcardSimulation::buildImage(const char* path, int fragmentRun)
+{
+    //Strip the trailing slash, the host paths are made with path + "/" + name.
+    std::string dirPath = path;
+    while(dirPath.length() > 1 && (dirPath[dirPath.length() - 1] == '/' || dirPath[dirPath.length() - 1] == '\\'))
+        dirPath.erase(dirPath.length() - 1);
+
+    fatImageBuilder builder(fragmentRun);
+    image = builder.build(dirPath.c_str(), &blockCount);
+}
+
+//The card works on a copy in memory, writes are not stored in the image file.
+void sdcardSimulation::loadImage(const char* filename)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        printf("Cannot open SD image: %s\n", filename);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    blockCount = ftell(f) / 512;
+    fseek(f, 0, SEEK_SET);
+    image = (uint8_t*)malloc(size_t(blockCount) * 512);
+    if (image == NULL || fread(image, 512, blockCount, f) != blockCount)
+    {
+        printf("Cannot read SD image: %s\n", filename);
+        exit(1);
+    }
+    fclose(f);
+}
+
+void sdcardSimulation::setLatency(int cmd, int byteCount)
+{
+    latency[cmd & 0x3F] = byteCount;
+}
+
+void sdcardSimulation::draw(int x, int y)
+{
+    char buffer[64];
+    sprintf(buffer, "SD R:%u/%u W:%u/%u", blocksRead, readCommands, blocksWritten, writeCommands);
+    drawString(x, y, buffer, 0xFFFFFF);
+}
+
+void sdcardSimulation::respond(int len, const uint8_t* data)
+{
+    memcpy(response, data, len);
+    responseLen = len;
+    responsePos = 0;
+}
+
+//Byte clocked out by the card while the host sends the next byte.
+uint8_t sdcardSimulation::output()
+{
+    if (delay > 0)
+    {
+        delay--;
+        return 0xFF;
+    }
+    if (responsePos < responseLen)
+        return response[responsePos++];
+    if (state == SD_STATE_READ)
+    {
+        if (dataDelay > 0)
         {
-            //FAT32 tables for file, just link to the next block
-            uint32_t* fat32 = (uint32_t*)sd_buffer;
-            for(uint8_t n=0;n<128;n++)
-                fat32[n] = (nr-2) * 128 + n + 1;
+            dataDelay--;
+            return 0xFF;
         }
-        else if (nr >= 0x500 && nr < 0x20000)
+        if (dataPos == 0)
         {
-            //Actual data blocks
-            fseek(simFile, (nr - 0x501) * 512, SEEK_SET);
-            fread(sd_buffer, 512, 1, simFile);
-        }else{
-            memset(sd_buffer, 0xFF, 512);
-            printf("Read SD?: %x\n", nr);
-            //exit(1);
+            dataCrc = CRC_CCITT(image + size_t(blockNr) * 512, 512);
+            dataPos++;
+            return DATA_START_BLOCK;
         }
-        break;
+        if (dataPos <= 512)
+            return image[size_t(blockNr) * 512 + dataPos++ - 1];
+        dataPos++;
+        if (dataPos == 512 + 2)
+            return dataCrc >> 8;
+        //Last CRC byte, the block is done.
+        blocksRead++;
+        blockNr++;
+        dataPos = 0;
+        dataDelay = latency[18] + 1;
+        if (!multiBlock || blockNr >= blockCount)
+            state = SD_STATE_IDLE;
+        return dataCrc;
     }
-    
-    uint16_t crc = CRC_CCITT(sd_buffer, 512);
-    sd_buffer[512] = crc >> 8;
-    sd_buffer[513] = crc;
+    if (busy > 0)
+    {
+        busy--;
+        return 0x00;
+    }
+    return 0xFF;
 }
 
-void sdcardSimulation::ISP_SPDR_callback(uint8_t oldValue, uint8_t& newValue)
+//Byte sent by the host.
+void sdcardSimulation::input(uint8_t data)
 {
-    if (errorRate && (rand() % errorRate) == 0)
-        newValue = rand();
-    if ((PING & _BV(2)))
+    switch(state)
     {
-        //No card inserted, return 0xFF
-        newValue = 0xFF;
-        SPSR |= _BV(SPIF);//Mark transfer finished
+    case SD_STATE_WRITE_DATA:
+        writeBuffer[dataPos++] = data;
+        if (dataPos == 512 + 2)
+        {
+            //The CRC is not checked in SPI mode.
+            uint8_t dataResponse = 0x05;//Data accepted
+            if (blockNr < blockCount)
+            {
+                memcpy(image + size_t(blockNr) * 512, writeBuffer, 512);
+                blocksWritten++;
+            }else{
+                dataResponse = 0x0D;//Write error
+            }
+            blockNr++;
+            respond(1, &dataResponse);
+            busy = latency[multiBlock ? 25 : 24];
+            state = multiBlock ? SD_STATE_WRITE_WAIT : SD_STATE_IDLE;
+        }
+        return;
+    case SD_STATE_WRITE_WAIT:
+        if (multiBlock && data == STOP_TRAN_TOKEN)
+        {
+            delay = 1;
+            busy = latency[25];
+            state = SD_STATE_IDLE;
+            return;
+        }
+        if (data == (multiBlock ? WRITE_MULTIPLE_TOKEN : DATA_START_BLOCK))
+        {
+            dataPos = 0;
+            state = SD_STATE_WRITE_DATA;
+            return;
+        }
+        break;
+    }
+
+    //Commands start with 01xxxxxx, the host sends 0xFF while it reads.
+    if (cmdPos == 0 && (data & 0xC0) != 0x40)
         return;
+    cmd[cmdPos++] = data;
+    if (cmdPos == 6) // 1 cmd, 4 param, 1 crc
+    {
+        cmdPos = 0;
+        command();
     }
-    switch(sd_state)
+}
+
+void sdcardSimulation::command()
+{
+    uint8_t index = cmd[0] & 0x3F;
+    uint32_t arg = (uint32_t(cmd[1]) << 24) | (uint32_t(cmd[2]) << 16) | (uint32_t(cmd[3]) << 8) | cmd[4];
+    uint8_t r[5];
+
+    delay = latency[index];
+    busy = 0;
+    if (appCmd)
     {
-    case 0://Read CMD
-    case 2://Read ACMD
-        sd_buffer[sd_buffer_pos++] = newValue;
-        if (sd_buffer_pos == 1 && (sd_buffer[0] & 0xC0) != 0x40)
-            sd_buffer_pos = 0;
-        if (sd_buffer_pos == 6) // 1 cmd, 4 param, 1 crc
-            sd_state += 1;
-        break;
-    case 1://Return status of CMD
-        sd_state = 0;
-        sd_buffer_pos = 0;
-        
-        switch(sd_buffer[0] & 0x3F)
+        appCmd = false;
+        switch(index)
         {
-        case 0x00://CMD0 - GO_IDLE_STATE
-            newValue = 0x01;         //Report R1_IDLE_STATE
-            break;
-        case 0x08://CMD8 - SEND_IF_COND
-            newValue = 0x04;         //Report R1_ILLEGAL_COMMAND
-            break;
-        case 0x0C://CMD12 - STOP_TRANSMISSION
-            newValue = 0x01;         //Report R1_IDLE_STATE
-            break;
-        case 0x11://CMD17 - READ_SINGLE_BLOCK
-            newValue = 0x00;//R1_READY_STATE
-            sd_read_block_nr = (sd_buffer[1] << 24) | (sd_buffer[2] << 16) | (sd_buffer[3] << 8) | (sd_buffer[4] << 0);
-            read_sd_block(sd_read_block_nr >> 9);
-            sd_state = 10;
-            sd_buffer_pos = 0;
-            break;
-        case 0x37://CMD55 - APP_CMD
-            sd_state = 2;
+        case 0x17://ACMD23 - SET_WR_BLK_ERASE_COUNT
+        case 0x29://ACMD41 - SD_SEND_OP_COMD
+            r[0] = 0x00;//R1_READY_STATE
             break;
         default:
-            printf("SD CMD: %02x %02x %02x %02x %02x %02x\n", sd_buffer[0] & 0x3F, sd_buffer[1], sd_buffer[2], sd_buffer[3], sd_buffer[4], sd_buffer[5]);
+            printf("SD ACMD: %02x %02x %02x %02x %02x %02x\n", index, cmd[1], cmd[2], cmd[3], cmd[4], cmd[5]);
+            r[0] = 0x04;//R1_ILLEGAL_COMMAND
             break;
         }
+        respond(1, r);
+        return;
+    }
+    switch(index)
+    {
+    case 0x00://CMD0 - GO_IDLE_STATE
+        state = SD_STATE_IDLE;
+        r[0] = 0x01;//R1_IDLE_STATE
+        respond(1, r);
+        break;
+    case 0x08://CMD8 - SEND_IF_COND, echo the voltage and check pattern
+        r[0] = 0x01;
+        r[1] = 0x00;
+        r[2] = 0x00;
+        r[3] = (arg >> 8) & 0x0F;
+        r[4] = arg;
+        respond(5, r);
+        break;
+    case 0x0C://CMD12 - STOP_TRANSMISSION, the host skips a stuff byte first
+        state = SD_STATE_IDLE;
+        delay++;
+        r[0] = 0x00;
+        respond(1, r);
         break;
-    case 3://Return status of ACMD
-        sd_state = 0;
-        sd_buffer_pos = 0;
-        
-        switch(sd_buffer[0] & 0x3F)
+    case 0x0D://CMD13 - SEND_STATUS
+        r[0] = 0x00;
+        r[1] = 0x00;
+        respond(2, r);
+        break;
+    case 0x11://CMD17 - READ_SINGLE_BLOCK
+    case 0x12://CMD18 - READ_MULTIPLE_BLOCK
+    case 0x18://CMD24 - WRITE_BLOCK
+    case 0x19://CMD25 - WRITE_MULTIPLE_BLOCK
+        //SDHC, the argument is the block number.
+        delay = 0;
+        if (arg >= blockCount)
         {
-        case 0x29://ACMD41 - SD_SEND_OP_COMD
-            newValue = 0x00;//R1_READY_STATE
-            break;
-        default:
-            printf("SD ACMD: %02x %02x %02x %02x %02x %02x\n", sd_buffer[0] & 0x3F, sd_buffer[1], sd_buffer[2], sd_buffer[3], sd_buffer[4], sd_buffer[5]);
+            r[0] = 0x20;//R1_ADDRESS_ERROR
+            respond(1, r);
             break;
         }
-        break;
-    case 10://READ BLOCK
-        if (sd_buffer_pos == 0)
-            newValue = 0xFE;//DATA_START_BLOCK
-        else
-            newValue = sd_buffer[sd_buffer_pos-1];
-        
-        sd_buffer_pos++;
-        if (sd_buffer_pos == 512 + 1 + 2)
+        blockNr = arg;
+        multiBlock = index == 0x12 || index == 0x19;
+        if (index == 0x11 || index == 0x12)
         {
-            sd_state = 0;
-            sd_buffer_pos = 0;
+            readCommands++;
+            state = SD_STATE_READ;
+            dataPos = 0;
+            dataDelay = latency[index] + 1;
+        }else{
+            writeCommands++;
+            state = SD_STATE_WRITE_WAIT;
         }
+        r[0] = 0x00;
+        respond(1, r);
         break;
+    case 0x37://CMD55 - APP_CMD
+        appCmd = true;
+        r[0] = 0x00;
+        respond(1, r);
+        break;
+    case 0x3A://CMD58 - READ_OCR, powered up and high capacity
+        r[0] = 0x00;
+        r[1] = 0xC0;
+        r[2] = 0xFF;
+        r[3] = 0x80;
+        r[4] = 0x00;
+        respond(5, r);
+        break;
+    default:
+        printf("SD CMD: %02x %02x %02x %02x %02x %02x\n", index, cmd[1], cmd[2], cmd[3], cmd[4], cmd[5]);
+        r[0] = 0x04;//R1_ILLEGAL_COMMAND
+        respond(1, r);
+        break;
+    }
+}
+
+void sdcardSimulation::ISP_SPDR_callback(uint8_t oldValue, uint8_t& newValue)
+{
+    if ((PING & _BV(2)))
+    {
+        //No card inserted, return 0xFF
+        newValue = 0xFF;
+        SPSR |= _BV(SPIF);//Mark transfer finished
+        return;
     }
-    //Introduce random errors in SD communication
+    //The card answers a byte after it is received, so the output is taken before the input is handled.
+    uint8_t data = newValue;
+    newValue = output();
+    input(data);
+
+    //Introduce random errors in the data from the card, the firmware detects them with the CRC and retries.
     if (errorRate && (rand() % errorRate) == 0)
         newValue = rand();
 
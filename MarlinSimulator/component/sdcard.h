@@ -3,22 +3,49 @@
 
 #include "base.h"
 
+//SD card in SPI mode, backed by a FAT32 image in memory.
+//basePath is a directory to build the image from, or an image file (.img) of a formatted card.
 class sdcardSimulation : public simBaseComponent
 {
-private:
-    const char* basePath;
 public:
-    sdcardSimulation(const char* basePath, int errorRate=0);
+    //fragmentRun leaves a gap of free clusters after every fragmentRun clusters of each file, 0 stores the files contiguous.
+    sdcardSimulation(const char* basePath, int errorRate=0, int fragmentRun=0);
     virtual ~sdcardSimulation();
-    
-    void ISP_SPDR_callback(uint8_t oldValue, uint8_t& newValue);
-    void read_sd_block(int nr);
 
-    int sd_state;
-    uint8_t sd_buffer[1024];
-    int sd_buffer_pos;
-    int sd_read_block_nr;
+    //Latency in SPI byte times (1us at the full SPI rate). CMD17/CMD18: before each data block, CMD24/CMD25: busy after each data block, other commands: before the response.
+    void setLatency(int cmd, int byteCount);
+
+    virtual void draw(int x, int y);
+
+    unsigned int blocksRead, blocksWritten;
+    unsigned int readCommands, writeCommands;
+private:
+    uint8_t* image;
+    uint32_t blockCount;
     int errorRate;
+    int latency[64];
+
+    int state;
+    bool appCmd;
+    bool multiBlock;
+    uint8_t cmd[6];
+    int cmdPos;
+    uint8_t response[8];
+    int responseLen, responsePos;
+    int delay, busy;
+    uint32_t blockNr;
+    int dataPos, dataDelay;
+    uint16_t dataCrc;
+    uint8_t writeBuffer[512 + 2];
+
+    void buildImage(const char* path, int fragmentRun);
+    void loadImage(const char* filename);
+    uint8_t output();
+    void input(uint8_t data);
+    void command();
+    void respond(int len, const uint8_t* data);
+
+    void ISP_SPDR_callback(uint8_t oldValue, uint8_t& newValue);
 };
 
 #endif//SDCARD_SIM_H
@@ -27,6 +27,24 @@ extern uint8_t __eeprom__storage[4096];
 bool cardInserted = true;
 int stoppedValue;
 
+//The SD card is built from this directory, or loaded when it is an .img file.
+static const char* sdcardPath = "c:/models/";
+static int sdcardFragmentRun = 0;
+
+//Command line: [models directory or .img file] [fragment run in clusters]
+void sim_parse_args(int argc, char** argv)
+{
+    if (argc > 1)
+        sdcardPath = argv[1];
+    if (argc > 2)
+        sdcardFragmentRun = atoi(argv[2]);
+    if (argc > 3 || sdcardFragmentRun < 0)
+    {
+        fprintf(stderr, "Usage: %s [models directory or .img file] [fragment run]\n", argv[0]);
+        exit(1);
+    }
+}
+
 void setupGui()
 {
     if ( SDL_Init(SDL_INIT_VIDEO) < 0 ) 
@@ -234,10 +252,24 @@ void sim_setup_main()
     e0Step->setDrawPosition(130, 100);
     e1Step->setDrawPosition(130, 110);
     
-    (new heaterSim(HEATER_0_PIN, adc, TEMP_0_PIN))->setDrawPosition(130, 70);
-    (new heaterSim(HEATER_1_PIN, adc, TEMP_1_PIN))->setDrawPosition(130, 80);
-    (new heaterSim(HEATER_BED_PIN, adc, TEMP_BED_PIN, 0.2))->setDrawPosition(130, 90);
-    new sdcardSimulation("c:/models/", 5000);
+    //Hotends: 25W cartridge in an aluminium block, heats up to 210C in about 90 seconds, the print fan blows over the nozzles.
+    //Bed: 220W on a glass and aluminium plate, the thermistor sits under the plate and lags behind.
+    heaterSim* heater0 = new heaterSim(arduinoIO, HEATER_0_PIN, adc, TEMP_0_PIN, HEATER_0_TEMPTABLE, HEATER_0_TEMPTABLE_LEN, 25.0, 9.0, 0.06, 2.0);
+    heater0->setFan(FAN_PIN, 0.04);
+    heater0->setFilament(e0Step, stepsPerUnit[E_AXIS], 2.85);
+    heater0->setDrawPosition(130, 70);
+    heaterSim* heater1 = new heaterSim(arduinoIO, HEATER_1_PIN, adc, TEMP_1_PIN, HEATER_1_TEMPTABLE, HEATER_1_TEMPTABLE_LEN, 25.0, 9.0, 0.06, 2.0);
+    heater1->setFan(FAN_PIN, 0.04);
+    heater1->setFilament(e1Step, stepsPerUnit[E_AXIS], 2.85);
+    heater1->setDrawPosition(130, 80);
+    (new heaterSim(arduinoIO, HEATER_BED_PIN, adc, TEMP_BED_PIN, BEDTEMPTABLE, BEDTEMPTABLE_LEN, 220.0, 800.0, 1.2, 8.0))->setDrawPosition(130, 90);
+    //The card holds a FAT32 image of the models directory. Latency like a typical card: about 100us to the first data byte, 1ms to program a block.
+    sdcardSimulation* sdcard = new sdcardSimulation(sdcardPath, 5000, sdcardFragmentRun);
+    sdcard->setLatency(17, 100);
+    sdcard->setLatency(18, 100);
+    sdcard->setLatency(24, 1000);
+    sdcard->setLatency(25, 1000);
+    sdcard->setDrawPosition(130, 120);
     (new serialSim())->setDrawPosition(150, 0);
 #if defined(ULTIBOARD_V2_CONTROLLER) || defined(ENABLE_ULTILCD2)
     i2cSim* i2c = new i2cSim();